@@ -0,0 +1,106 @@
+#include "AdaptiveTuner.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+struct JustInterval
+{
+    double cents;
+    double weight;
+};
+
+// Within one octave. Weights fall off with the ratio's complexity, roughly 1 / log2(numerator * denominator).
+const std::array<JustInterval, 14> justIntervals {{
+    {0.0, 1.0},                         // 1/1
+    {111.731, 1.0 / std::log2 (240.0)}, // 16/15
+    {203.910, 1.0 / std::log2 (72.0)},  // 9/8
+    {266.871, 1.0 / std::log2 (42.0)},  // 7/6
+    {315.641, 1.0 / std::log2 (30.0)},  // 6/5
+    {386.314, 1.0 / std::log2 (20.0)},  // 5/4
+    {498.045, 1.0 / std::log2 (12.0)},  // 4/3
+    {582.512, 1.0 / std::log2 (35.0)},  // 7/5
+    {701.955, 1.0 / std::log2 (6.0)},   // 3/2
+    {813.686, 1.0 / std::log2 (40.0)},  // 8/5
+    {884.359, 1.0 / std::log2 (15.0)},  // 5/3
+    {968.826, 1.0 / std::log2 (28.0)},  // 7/4
+    {1088.269, 1.0 / std::log2 (120.0)}, // 15/8
+    {1200.0, 1.0},                      // 2/1
+}};
+
+// Intervals further than this from every just one are left alone
+constexpr double captureCents = 20.0;
+
+// Pull toward the tempered pitch, relative to the pair weights above
+constexpr double anchorWeight = 0.05;
+} // namespace
+
+void AdaptiveTuner::voiceStarted (int channel, double pitch)
+{
+    m_active[(size_t) channel] = true;
+    m_pitches[(size_t) channel] = pitch;
+    m_offsets[(size_t) channel] = 0.0;
+    updatePairs (channel);
+}
+
+void AdaptiveTuner::voiceStopped (int channel)
+{
+    m_active[(size_t) channel] = false;
+    m_offsets[(size_t) channel] = 0.0;
+    updatePairs (channel);
+}
+
+void AdaptiveTuner::reset()
+{
+    m_active.fill (false);
+    m_offsets.fill (0.0);
+    for (auto& row : m_weights)
+        row.fill (0.0);
+}
+
+void AdaptiveTuner::updatePairs (int channel)
+{
+    auto i = (size_t) channel;
+    for (size_t j = 1; j < (size_t) numChannels; ++j) {
+        m_weights[i][j] = m_weights[j][i] = 0.0;
+        if (j == i || ! m_active[i] || ! m_active[j])
+            continue;
+
+        auto cents = 100.0 * (m_pitches[j] - m_pitches[i]);
+        auto reduced = cents - 1200.0 * std::floor (cents / 1200.0);
+
+        const JustInterval* nearest = nullptr;
+        for (const auto& interval : justIntervals) {
+            if (std::abs (interval.cents - reduced) <= captureCents
+                && (nearest == nullptr || std::abs (interval.cents - reduced) < std::abs (nearest->cents - reduced)))
+                nearest = &interval;
+        }
+        if (nearest == nullptr)
+            continue;
+
+        m_weights[i][j] = m_weights[j][i] = nearest->weight;
+        m_targets[i][j] = nearest->cents - reduced;
+        m_targets[j][i] = -m_targets[i][j];
+    }
+}
+
+void AdaptiveTuner::solve (int numSweeps)
+{
+    for (int sweep = 0; sweep < numSweeps; ++sweep) {
+        for (size_t i = 1; i < (size_t) numChannels; ++i) {
+            if (! m_active[i])
+                continue;
+
+            // Minimises sum_j w_ij (o_j - o_i - t_ij)^2 + anchor * o_i^2 over o_i, holding the others fixed
+            double numerator = 0.0, denominator = anchorWeight;
+            for (size_t j = 1; j < (size_t) numChannels; ++j) {
+                if (m_weights[i][j] > 0.0) {
+                    numerator += m_weights[i][j] * (m_offsets[j] - m_targets[i][j]);
+                    denominator += m_weights[i][j];
+                }
+            }
+            m_offsets[i] = std::clamp (numerator / denominator, -maxOffsetCents, maxOffsetCents);
+        }
+    }
+}
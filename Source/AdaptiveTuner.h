@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+// Nudges sounding voices toward just intervals with each other.
+//
+// Each output channel holding a voice is a node with a tempered pitch and an offset in cents. Every pair of nodes
+// whose (octave-reduced) interval lies close to a simple ratio pulls their offsets apart by the difference, weighted
+// by how simple the ratio is, while a weak anchor keeps everything near the tempered pitches. solve() runs a fixed
+// number of Gauss-Seidel sweeps from wherever the last call left off, so the cost per block is bounded (at most
+// 15 x 15 pair updates per sweep) and it converges over successive blocks as chords are held. No allocation.
+class AdaptiveTuner
+{
+public:
+    static constexpr int numChannels = 17; // indexed by MIDI channel, 1-16
+    static constexpr double maxOffsetCents = 25.0;
+
+    // The voice on `channel` now sounds at `pitch` (fractional MIDI note, as tempered)
+    void voiceStarted (int channel, double pitch);
+    void voiceStopped (int channel);
+    void reset();
+
+    void solve (int numSweeps);
+
+    bool isActive (int channel) const { return m_active[(std::size_t) channel]; }
+    double getOffsetCents (int channel) const { return m_offsets[(std::size_t) channel]; }
+
+private:
+    void updatePairs (int channel);
+
+    std::array<bool, numChannels> m_active {};
+    std::array<double, numChannels> m_pitches {};
+    std::array<double, numChannels> m_offsets {};
+
+    // For each pair, how much the offsets should differ by (cents, j minus i) and how hard to pull
+    std::array<std::array<double, numChannels>, numChannels> m_targets {};
+    std::array<std::array<double, numChannels>, numChannels> m_weights {};
+};
@@ -0,0 +1,27 @@
+#include "DeviceInput.h"
+
+void DeviceInput::handleIncomingMidiMessage (juce::MidiInput*, const juce::MidiMessage& message)
+{
+    // SysEx from the Lumatone answers configuration messages; it isn't playing
+    auto numBytes = message.getRawDataSize();
+    if (numBytes > 3)
+        return;
+
+    Event event {juce::Time::getMillisecondCounterHiRes(), numBytes, {}};
+    std::copy (message.getRawData(), message.getRawData() + numBytes, event.data.begin());
+    if (! m_events.push (event))
+        m_dropped.fetch_add (1, std::memory_order_relaxed);
+}
+
+void DeviceInput::readBlock (juce::MidiBuffer& midi, int numSamples, double sampleRate)
+{
+    midi.clear();
+
+    auto blockStartMs = juce::Time::getMillisecondCounterHiRes() - numSamples * 1000.0 / sampleRate;
+    auto lastPosition = std::max (0, numSamples - 1);
+
+    m_events.popAll ([&] (const Event& event) {
+        auto position = (int) ((event.timeMs - blockStartMs) * sampleRate / 1000.0);
+        midi.addEvent (event.data.data(), event.numBytes, std::clamp (position, 0, lastPosition));
+    });
+}
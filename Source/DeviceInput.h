@@ -0,0 +1,38 @@
+#pragma once
+
+#include "SpscRing.h"
+
+#include <juce_audio_devices/juce_audio_devices.h>
+
+#include <array>
+#include <atomic>
+
+// The MIDI input of a second (third, ...) Lumatone in the Standalone app. Its MIDI thread timestamps each message
+// into a FIFO of its own that only the audio thread reads, so one instrument never waits on another, nor on the
+// lock inside the AudioProcessorPlayer's message collector that every input enabled in the AudioDeviceManager shares.
+// Messages that don't fit are dropped and counted. The app owns these, so they outlive any processor reading them.
+class DeviceInput : public juce::MidiInputCallback
+{
+public:
+    static constexpr juce::uint32 capacity = 2048;
+
+    // MIDI thread
+    void handleIncomingMidiMessage (juce::MidiInput*, const juce::MidiMessage& message) override;
+
+    // Audio thread. Replaces `midi` with what arrived since the last call, placed within the block by arrival time
+    // as if the block ended now. `midi` should have room reserved for `capacity` short messages.
+    void readBlock (juce::MidiBuffer& midi, int numSamples, double sampleRate);
+
+    int getNumDropped() const { return m_dropped.load(); }
+
+private:
+    struct Event
+    {
+        double timeMs;
+        int numBytes;
+        std::array<juce::uint8, 3> data;
+    };
+
+    SpscRing<Event, capacity> m_events;
+    std::atomic<int> m_dropped {0};
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Plugin.h"
+#include "Trace.h"
 #include "VelocityFixupEditor.h"
 
 #include <juce_audio_processors/juce_audio_processors.h>
@@ -34,49 +35,127 @@ public:
         m_velocityFixupButton.onClick = [this]() { openVelocityFixupEditor(); };
         addAndMakeVisible (m_velocityFixupButton);
 
-        // Global velocity power slider
-        m_globalVelocityPowerSlider.setRange (0.1, 10.0, 0.01);
-        m_globalVelocityPowerSlider.setValue (
-            static_cast<LumatoneInterpreterProcessor&> (processor).getGlobalVelocityPower(),
-            juce::dontSendNotification);
+        // Global velocity power slider. The attachment takes the parameter's (skewed) range and tells the host when a
+        // drag starts and ends, so touch and latch automation record it.
         m_globalVelocityPowerSlider.setTextBoxStyle (juce::Slider::TextBoxLeft, false, 80, 20);
-        m_globalVelocityPowerSlider.onValueChange = [this]() {
-            auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
-            proc.setGlobalVelocityPower ((float) m_globalVelocityPowerSlider.getValue());
-        };
+        m_globalVelocityPowerAttachment = std::make_unique<juce::SliderParameterAttachment> (
+            proc.getVelocityPowerParameter(), m_globalVelocityPowerSlider);
         addAndMakeVisible (m_globalVelocityPowerSlider);
 
         m_globalVelocityPowerLabel.setText ("Global Velocity Exp:", juce::dontSendNotification);
         m_globalVelocityPowerLabel.attachToComponent (&m_globalVelocityPowerSlider, true);
 
-        // Tuning system selector
+        // CC-mode attack estimation
+        m_attackWindowSlider.setRange (0.0, 10.0, 0.1);
+        m_attackWindowSlider.setValue (proc.getAttackWindowMs(), juce::dontSendNotification);
+        m_attackWindowSlider.setTextValueSuffix (" ms");
+        m_attackWindowSlider.setTextBoxStyle (juce::Slider::TextBoxLeft, false, 80, 20);
+        m_attackWindowSlider.onValueChange = [this]() {
+            auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
+            proc.setAttackWindowMs ((float) m_attackWindowSlider.getValue());
+        };
+        addAndMakeVisible (m_attackWindowSlider);
+
+        m_attackWindowLabel.setText ("Attack Window:", juce::dontSendNotification);
+        m_attackWindowLabel.attachToComponent (&m_attackWindowSlider, true);
+
+        m_attackSamplesSlider.setRange (1.0, (double) PressureVelocityEstimator::capacity, 1.0);
+        m_attackSamplesSlider.setValue (proc.getAttackMaxSamples(), juce::dontSendNotification);
+        m_attackSamplesSlider.setTextBoxStyle (juce::Slider::TextBoxLeft, false, 80, 20);
+        m_attackSamplesSlider.onValueChange = [this]() {
+            auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
+            proc.setAttackMaxSamples ((int) m_attackSamplesSlider.getValue());
+        };
+        addAndMakeVisible (m_attackSamplesSlider);
+
+        m_attackSamplesLabel.setText ("Attack Samples:", juce::dontSendNotification);
+        m_attackSamplesLabel.attachToComponent (&m_attackSamplesSlider, true);
+
+        // Preset selector (the programs a Program Change on channel 1 picks from)
+        for (int i = 0; i < proc.getNumPrograms(); ++i)
+            m_presetSelector.addItem (proc.getProgramName (i), i + 1);
+        m_presetSelector.setSelectedId (proc.getCurrentProgram() + 1, juce::dontSendNotification);
+        m_presetSelector.onChange = [this]() {
+            auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
+            proc.setCurrentProgram (m_presetSelector.getSelectedId() - 1);
+        };
+        addAndMakeVisible (m_presetSelector);
+
+        m_presetSelectorLabel.setText ("Preset:", juce::dontSendNotification);
+        m_presetSelectorLabel.attachToComponent (&m_presetSelector, true);
+
+        // Tuning system selector, in the parameter's order
         const auto& tunings = proc.getAvailableTunings();
         for (size_t i = 0; i < tunings.size(); ++i) {
             m_tuningSelector.addItem (tunings[i].name, static_cast<int> (i + 1));
         }
-        m_tuningSelector.setSelectedId (proc.getCurrentTuningIndex() + 1, juce::dontSendNotification);
-        m_tuningSelector.onChange = [this]() {
-            auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
-            proc.setCurrentTuningIndex (m_tuningSelector.getSelectedId() - 1);
-        };
+        m_tuningAttachment =
+            std::make_unique<juce::ComboBoxParameterAttachment> (proc.getTuningParameter(), m_tuningSelector);
         addAndMakeVisible (m_tuningSelector);
 
         m_tuningSelectorLabel.setText ("Tuning:", juce::dontSendNotification);
         m_tuningSelectorLabel.attachToComponent (&m_tuningSelector, true);
 
+        // Output mode selector
+        using OutputMode = LumatoneInterpreterProcessor::OutputMode;
+        m_outputModeSelector.addItem ("Channel per voice (pitch bend)", (int) OutputMode::channelPerVoice + 1);
+        m_outputModeSelector.addItem ("MIDI Tuning Standard", (int) OutputMode::mts + 1);
+        m_outputModeSelector.setSelectedId ((int) proc.getOutputMode() + 1, juce::dontSendNotification);
+        m_outputModeSelector.onChange = [this]() {
+            auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
+            proc.setOutputMode ((LumatoneInterpreterProcessor::OutputMode) (m_outputModeSelector.getSelectedId() - 1));
+        };
+        addAndMakeVisible (m_outputModeSelector);
+
+        m_outputModeSelectorLabel.setText ("Output:", juce::dontSendNotification);
+        m_outputModeSelectorLabel.attachToComponent (&m_outputModeSelector, true);
+
+        m_adaptiveTuningButton.setButtonText ("Adaptive Just Intonation");
+        m_adaptiveTuningButton.setToggleState (proc.getAdaptiveTuning(), juce::dontSendNotification);
+        m_adaptiveTuningButton.onClick = [this]() {
+            auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
+            proc.setAdaptiveTuning (m_adaptiveTuningButton.getToggleState());
+        };
+        addAndMakeVisible (m_adaptiveTuningButton);
+
+        m_ledFeedbackButton.setButtonText ("Light Sounding Keys");
+        m_ledFeedbackButton.setToggleState (proc.getLedFeedback().isEnabled(), juce::dontSendNotification);
+        m_ledFeedbackButton.onClick = [this]() {
+            auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
+            proc.setLedFeedbackEnabled (m_ledFeedbackButton.getToggleState());
+        };
+        addAndMakeVisible (m_ledFeedbackButton);
+
+#if LUMATONE_TRACE
+        m_traceButton.setButtonText ("Record Trace");
+        m_traceButton.setToggleState (TraceRecorder::isRecording(), juce::dontSendNotification);
+        m_traceButton.onClick = [this]() { TraceRecorder::setRecording (m_traceButton.getToggleState()); };
+        addAndMakeVisible (m_traceButton);
+#endif
+
         startTimerHz (10);
 
-        setSize ((int) (1.618f * 400), 400);
+        setSize ((int) (1.618f * 450), 450);
     }
 
     void resized() override
     {
         auto bounds = getLocalBounds().reduced (8);
+        {
+            auto presetArea = bounds.removeFromTop (40);
+            m_presetSelectorLabel.setBounds (presetArea.removeFromLeft (100));
+            m_presetSelector.setBounds (presetArea);
+        }
         {
             auto tuningArea = bounds.removeFromTop (40);
             m_tuningSelectorLabel.setBounds (tuningArea.removeFromLeft (100));
             m_tuningSelector.setBounds (tuningArea);
         }
+        {
+            auto outputModeArea = bounds.removeFromTop (40);
+            m_outputModeSelectorLabel.setBounds (outputModeArea.removeFromLeft (100));
+            m_outputModeSelector.setBounds (outputModeArea);
+        }
         m_velocityFixupButton.setBounds (bounds.removeFromTop (40));
         bounds.removeFromTop (8);
         {
@@ -85,18 +164,44 @@ public:
             m_globalVelocityPowerSlider.setBounds (globalVelocityArea);
         }
         bounds.removeFromTop (8);
+        {
+            auto attackWindowArea = bounds.removeFromTop (30);
+            m_attackWindowLabel.setBounds (attackWindowArea.removeFromLeft (100));
+            m_attackWindowSlider.setBounds (attackWindowArea);
+        }
+        bounds.removeFromTop (8);
+        {
+            auto attackSamplesArea = bounds.removeFromTop (30);
+            m_attackSamplesLabel.setBounds (attackSamplesArea.removeFromLeft (100));
+            m_attackSamplesSlider.setBounds (attackSamplesArea);
+        }
+        bounds.removeFromTop (8);
+        {
+            auto togglesArea = bounds.removeFromTop (30);
+            m_adaptiveTuningButton.setBounds (togglesArea.removeFromLeft (togglesArea.getWidth() / 2));
+            m_ledFeedbackButton.setBounds (togglesArea);
+        }
+        bounds.removeFromTop (8);
+#if LUMATONE_TRACE
+        m_traceButton.setBounds (bounds.removeFromTop (30));
+        bounds.removeFromTop (8);
+#endif
         m_activeVoicesLabel.setBounds (bounds);
     }
 
 private:
     void timerCallback() override
     {
+        LUMATONE_TRACE_SCOPE ("LumatoneInterpreterEditor::timerCallback");
+
         auto& proc = static_cast<LumatoneInterpreterProcessor&> (processor);
         m_activeVoicesLabel.setText (
-            "Active voices: " + juce::String (proc.getActiveVoices()), juce::dontSendNotification);
+            "Active voices: " + juce::String (proc.getActiveVoices()) + "\nLast attack latency: "
+                + juce::String (proc.getLastAttackLatencyMs(), 2) + " ms",
+            juce::dontSendNotification);
 
-        // Update global velocity power slider to reflect current value
-        m_globalVelocityPowerSlider.setValue (proc.getGlobalVelocityPower(), juce::dontSendNotification);
+        // The parameters' controls follow them through their attachments; the program isn't a parameter
+        m_presetSelector.setSelectedId (proc.getCurrentProgram() + 1, juce::dontSendNotification);
     }
 
     void openVelocityFixupEditor()
@@ -131,7 +236,22 @@ private:
     juce::TextButton m_velocityFixupButton;
     juce::Slider m_globalVelocityPowerSlider;
     juce::Label m_globalVelocityPowerLabel;
+    juce::Slider m_attackWindowSlider;
+    juce::Label m_attackWindowLabel;
+    juce::Slider m_attackSamplesSlider;
+    juce::Label m_attackSamplesLabel;
+    juce::ComboBox m_presetSelector;
+    juce::Label m_presetSelectorLabel;
     juce::ComboBox m_tuningSelector;
     juce::Label m_tuningSelectorLabel;
+    juce::ComboBox m_outputModeSelector;
+    juce::Label m_outputModeSelectorLabel;
+    juce::ToggleButton m_adaptiveTuningButton;
+    juce::ToggleButton m_ledFeedbackButton;
+#if LUMATONE_TRACE
+    juce::ToggleButton m_traceButton;
+#endif
+    std::unique_ptr<juce::SliderParameterAttachment> m_globalVelocityPowerAttachment;
+    std::unique_ptr<juce::ComboBoxParameterAttachment> m_tuningAttachment;
     std::unique_ptr<VelocityFixupWindow> m_velocityFixupWindow;
 };
\ No newline at end of file
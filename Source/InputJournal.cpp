@@ -0,0 +1,439 @@
+#include "InputJournal.h"
+
+#include "Plugin.h"
+
+#include <numeric>
+
+namespace
+{
+enum RecordType : juce::uint8
+{
+    blockRecord = 1,
+    idleRunRecord = 2,
+    gapRecord = 3,
+    settingsRecord = 4,
+    controlRecord = 5,
+    lostRecord = 6
+};
+
+constexpr char journalMagic[] = {'L', 'T', 'J', '1'};
+} // namespace
+
+InputJournal::InputJournal()
+: Thread ("Input Journal")
+, m_pendingDirectory (getJournalDirectory())
+, m_filePrefix (
+      "journal-" + juce::Time::getCurrentTime().formatted ("%Y%m%d-%H%M%S") + "-"
+      + juce::String::toHexString (juce::Random::getSystemRandom().nextInt (0x1000000)).paddedLeft ('0', 6))
+{
+    m_pendingEvents.reserve (capacity);
+    startThread (juce::Thread::Priority::low);
+}
+
+InputJournal::~InputJournal()
+{
+    stopThread (2000);
+}
+
+juce::File InputJournal::getJournalDirectory()
+{
+    auto appDataDir = juce::File::getSpecialLocation (juce::File::userApplicationDataDirectory);
+    return appDataDir.getChildFile ("LumatoneInterpreter").getChildFile ("journal");
+}
+
+void InputJournal::setDirectory (const juce::File& directory)
+{
+    const juce::ScopedLock sl (m_settingsLock);
+    m_pendingDirectory = directory;
+}
+
+void InputJournal::prepare (double sampleRate, const juce::String& settings)
+{
+    if (! m_enabled.load (std::memory_order_relaxed))
+        return;
+
+    {
+        const juce::ScopedLock sl (m_settingsLock);
+        m_pendingSettings = settings;
+    }
+
+    // Losses from before don't belong in the new file
+    m_lostBlocks = 0;
+    m_lostSamples = 0;
+    m_entries.push ({Kind::prepare, 0, {}, (juce::int32) std::round (sampleRate)});
+}
+
+bool InputJournal::recordControl (Control control, juce::int32 value)
+{
+    if (! m_enabled.load (std::memory_order_relaxed))
+        return false;
+
+    return m_entries.push ({Kind::control, (juce::uint8) control, {}, value});
+}
+
+void InputJournal::recordBlock (
+    const juce::MidiBuffer& midi,
+    std::span<const juce::MidiBuffer> otherDevices,
+    int numSamples)
+{
+    if (! m_enabled.load (std::memory_order_relaxed))
+        return;
+
+    // Blocks go in whole or not at all, so the writer never sees half of one
+    auto numEvents = (juce::uint32) midi.getNumEvents();
+    for (const auto& deviceMidi : otherDevices)
+        numEvents += (juce::uint32) deviceMidi.getNumEvents();
+    auto hasGap = m_lostBlocks > 0;
+    if (m_entries.getFreeSpace() < numEvents + (hasGap ? 2 : 1)) {
+        ++m_lostBlocks;
+        m_lostSamples += numSamples;
+        return;
+    }
+
+    juce::uint32 numEntries = 0;
+    if (hasGap) {
+        auto blocks = std::min (m_lostBlocks, (juce::uint32) 0xffffff);
+        Entry gap {Kind::gap, 0, {}, (juce::int32) std::min (m_lostSamples, (juce::int64) 0x7fffffff)};
+        gap.data = {(juce::uint8) blocks, (juce::uint8) (blocks >> 8), (juce::uint8) (blocks >> 16)};
+        m_entries.getWriteSlot (numEntries++) = gap;
+        m_lostBlocks = 0;
+        m_lostSamples = 0;
+    }
+    m_entries.getWriteSlot (numEntries++) = {Kind::block, 0, {}, numSamples};
+    auto recordEvents = [&] (const juce::MidiBuffer& deviceMidi, int device) {
+        for (auto event : deviceMidi) {
+            if (event.numBytes > 3)
+                continue;
+
+            Entry entry {Kind::event, (juce::uint8) (device << 4 | event.numBytes), {}, event.samplePosition};
+            std::copy (event.data, event.data + event.numBytes, entry.data.begin());
+            m_entries.getWriteSlot (numEntries++) = entry;
+        }
+    };
+    recordEvents (midi, 0);
+    for (size_t i = 0; i < otherDevices.size() && i < 15; ++i)
+        recordEvents (otherDevices[i], (int) i + 1);
+    m_entries.finishWrite (numEntries);
+}
+
+void InputJournal::run()
+{
+    while (! threadShouldExit()) {
+        wait (100);
+        drain();
+    }
+    drain();
+    flushIdleRun();
+}
+
+void InputJournal::drain()
+{
+    // Every block is published together with its events, so the last one in this batch is complete too
+    int blockSamples = -1;
+    m_pendingEvents.clear();
+    m_entries.popAll ([&] (const Entry& entry) {
+        if (entry.kind == Kind::event) {
+            m_pendingEvents.push_back (entry);
+            return;
+        }
+
+        if (blockSamples >= 0)
+            writeBlock (blockSamples);
+        blockSamples = -1;
+        m_pendingEvents.clear();
+
+        if (entry.kind == Kind::prepare) {
+            {
+                const juce::ScopedLock sl (m_settingsLock);
+                m_settings = m_pendingSettings;
+                m_directory = m_pendingDirectory;
+            }
+            m_latestControls.fill (std::nullopt);
+            openNextFile (entry.value);
+        }
+        else if (entry.kind == Kind::control) {
+            auto control = (Control) entry.numBytes;
+            m_latestControls[(size_t) control] = entry.value;
+            writeControl (control, entry.value);
+        }
+        else if (entry.kind == Kind::gap) {
+            writeGap ((int) (entry.data[0] | entry.data[1] << 8 | entry.data[2] << 16), entry.value);
+        }
+        else {
+            blockSamples = entry.value;
+        }
+    });
+    if (blockSamples >= 0)
+        writeBlock (blockSamples);
+
+    if (m_output != nullptr)
+        m_output->flush();
+}
+
+void InputJournal::writeBlock (int numSamples)
+{
+    if (m_output == nullptr)
+        return;
+
+    if (m_pendingEvents.empty()) {
+        if (m_idleCount > 0 && m_idleSamples != numSamples)
+            flushIdleRun();
+        m_idleSamples = numSamples;
+        ++m_idleCount;
+        return;
+    }
+
+    flushIdleRun();
+    m_output->writeByte ((char) blockRecord);
+    m_output->writeInt (numSamples);
+    m_output->writeShort ((short) m_pendingEvents.size());
+    for (const auto& event : m_pendingEvents) {
+        m_output->writeShort ((short) event.value);
+        m_output->writeByte ((char) event.numBytes);
+        m_output->write (event.data.data(), event.data.size());
+    }
+
+    if (m_output->getPosition() > maxFileBytes)
+        openNextFile (m_sampleRate);
+}
+
+void InputJournal::writeControl (Control control, juce::int32 value)
+{
+    if (m_output == nullptr)
+        return;
+
+    flushIdleRun();
+    m_output->writeByte ((char) controlRecord);
+    m_output->writeByte ((char) control);
+    m_output->writeInt (value);
+}
+
+void InputJournal::writeGap (int numBlocks, int numSamples)
+{
+    if (m_output == nullptr)
+        return;
+
+    flushIdleRun();
+    m_output->writeByte ((char) lostRecord);
+    m_output->writeInt (numBlocks);
+    m_output->writeInt (numSamples);
+}
+
+void InputJournal::flushIdleRun()
+{
+    if (m_idleCount == 0 || m_output == nullptr)
+        return;
+
+    m_output->writeByte ((char) idleRunRecord);
+    m_output->writeInt (m_idleSamples);
+    m_output->writeInt ((int) m_idleCount);
+    m_idleCount = 0;
+}
+
+void InputJournal::openNextFile (int sampleRate)
+{
+    flushIdleRun();
+    m_output.reset();
+    m_sampleRate = sampleRate;
+
+    auto dir = m_directory;
+    if (! dir.exists())
+        dir.createDirectory();
+
+    // Drop this instance's oldest files beyond the limit, leaving room for the new one
+    auto existing = dir.findChildFiles (juce::File::findFiles, false, m_filePrefix + "-*.ltj");
+    std::sort (existing.begin(), existing.end(), [] (const juce::File& a, const juce::File& b) {
+        return a.getLastModificationTime() < b.getLastModificationTime();
+    });
+    for (int i = 0; i < existing.size() - (maxFiles - 1); ++i)
+        existing.getReference (i).deleteFile();
+
+    auto file = dir.getNonexistentChildFile (
+        m_filePrefix + "-" + juce::Time::getCurrentTime().formatted ("%Y%m%d-%H%M%S"), ".ltj", false);
+    auto output = std::make_unique<juce::FileOutputStream> (file);
+    if (output->failedToOpen()) {
+        std::cout << "Failed to open input journal " << file.getFullPathName() << std::endl;
+        return;
+    }
+
+    output->write (journalMagic, sizeof (journalMagic));
+    output->writeInt (sampleRate);
+    m_output = std::move (output);
+
+    if (m_settings.isNotEmpty()) {
+        auto numBytes = m_settings.getNumBytesAsUTF8();
+        m_output->writeByte ((char) settingsRecord);
+        m_output->writeInt ((int) numBytes);
+        m_output->write (m_settings.toRawUTF8(), numBytes);
+    }
+    for (size_t i = 0; i < m_latestControls.size(); ++i) {
+        if (m_latestControls[i].has_value())
+            writeControl ((Control) i, *m_latestControls[i]);
+    }
+}
+
+InputJournal::Reader::Reader (const juce::File& file) : m_input (file)
+{
+    char magic[sizeof (journalMagic)] = {};
+    if (m_input.failedToOpen() || m_input.read (magic, (int) sizeof (magic)) != (int) sizeof (magic)
+        || ! std::equal (magic, magic + sizeof (magic), journalMagic))
+        return;
+
+    m_sampleRate = m_input.readInt();
+
+    auto position = m_input.getPosition();
+    if (m_input.readByte() == settingsRecord) {
+        juce::MemoryBlock settings;
+        m_input.readIntoMemoryBlock (settings, m_input.readInt());
+        m_settings = juce::parseXML (settings.toString());
+    }
+    else {
+        m_input.setPosition (position);
+    }
+}
+
+bool InputJournal::Reader::readNextBlock (
+    std::span<juce::MidiBuffer> deviceMidi,
+    int& numSamples,
+    std::vector<std::pair<Control, juce::int32>>& controls)
+{
+    for (auto& midi : deviceMidi)
+        midi.clear();
+    controls.clear();
+
+    while (m_idleRemaining == 0) {
+        if (m_input.isExhausted())
+            return false;
+
+        switch (m_input.readByte()) {
+        case blockRecord: {
+            numSamples = m_input.readInt();
+            auto numEvents = (int) (juce::uint16) m_input.readShort();
+            for (int i = 0; i < numEvents; ++i) {
+                auto samplePosition = (int) (juce::uint16) m_input.readShort();
+                auto sizeByte = (juce::uint8) m_input.readByte();
+                auto size = (int) (sizeByte & 0x0f);
+                auto device = (size_t) (sizeByte >> 4);
+                juce::uint8 data[3] = {};
+                m_input.read (data, (int) sizeof (data));
+                if (device < deviceMidi.size())
+                    deviceMidi[device].addEvent (data, std::clamp (size, 1, 3), samplePosition);
+            }
+            return true;
+        }
+        case idleRunRecord:
+            m_idleSamples = m_input.readInt();
+            m_idleRemaining = m_input.readInt();
+            break;
+        case gapRecord:
+            m_input.readInt();
+            ++m_numGaps;
+            break;
+        case lostRecord: {
+            // Played back as empty blocks of the average length, so the time the lost blocks took still passes
+            auto numBlocks = m_input.readInt();
+            auto lostSamples = m_input.readInt();
+            ++m_numGaps;
+            if (numBlocks > 0) {
+                m_idleSamples = lostSamples / numBlocks;
+                m_idleRemaining = numBlocks;
+            }
+            break;
+        }
+        case settingsRecord:
+            // Only expected at the start of a file, which the constructor has read
+            m_input.skipNextBytes (m_input.readInt());
+            break;
+        case controlRecord: {
+            auto control = (juce::uint8) m_input.readByte();
+            auto value = (juce::int32) m_input.readInt();
+            if (control < (juce::uint8) Control::numControls)
+                controls.emplace_back ((Control) control, value);
+            break;
+        }
+        default:
+            // Truncated or corrupt
+            return false;
+        }
+    }
+
+    --m_idleRemaining;
+    numSamples = m_idleSamples;
+    return true;
+}
+
+int runJournalReplay (const juce::File& file, bool printOutput)
+{
+    InputJournal::Reader reader (file);
+    if (! reader.isValid()) {
+        std::cerr << "Not an input journal: " << file.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    constexpr int maxBlockSize = 8192;
+
+    auto processorPtr = std::make_unique<LumatoneInterpreterProcessor>();
+    auto& processor = *processorPtr;
+    processor.getInputJournal().setEnabled (false);
+    processor.setSettingsFileEnabled (false);
+    if (auto* settings = reader.getSettings())
+        processor.restoreJournalSnapshot (*settings);
+    else
+        std::cout << "The journal has no settings snapshot; replaying with the current settings" << std::endl;
+    processor.setRateAndBufferSizeDetails (reader.getSampleRate(), maxBlockSize);
+    processor.prepareToPlay (reader.getSampleRate(), maxBlockSize);
+
+    juce::AudioBuffer<float> audio (2, maxBlockSize);
+    std::array<juce::MidiBuffer, LumatoneInterpreterProcessor::maxDevices> deviceMidi;
+    for (auto& midi : deviceMidi)
+        midi.ensureSize (4096);
+    auto& midi = deviceMidi[0];
+
+    std::vector<std::pair<InputJournal::Control, juce::int32>> controls;
+    controls.reserve ((size_t) InputJournal::Control::numControls);
+    std::vector<double> blockMicros;
+    juce::int64 sampleTime = 0;
+    int numEventsIn = 0, numEventsOut = 0;
+    int numSamples = 0;
+
+    while (reader.readNextBlock (deviceMidi, numSamples, controls)) {
+        for (auto [control, value] : controls)
+            processor.applyJournalControl (control, value);
+
+        audio.setSize (2, numSamples, false, false, true);
+        for (const auto& events : deviceMidi)
+            numEventsIn += events.getNumEvents();
+
+        // Bypasses processBlock, which would take the other devices' input from their (idle) MIDI ports
+        auto start = juce::Time::getHighResolutionTicks();
+        processor.processDevices (audio, midi, std::span (deviceMidi).subspan (1));
+        auto end = juce::Time::getHighResolutionTicks();
+        blockMicros.push_back (juce::Time::highResolutionTicksToSeconds (end - start) * 1.0e6);
+
+        numEventsOut += midi.getNumEvents();
+        if (printOutput) {
+            for (auto event : midi)
+                std::cout << (sampleTime + event.samplePosition) << " " << event.getMessage().getDescription()
+                          << std::endl;
+        }
+        sampleTime += numSamples;
+    }
+
+    if (blockMicros.empty()) {
+        std::cerr << "Journal has no blocks" << std::endl;
+        return 1;
+    }
+
+    auto totalMicros = std::accumulate (blockMicros.begin(), blockMicros.end(), 0.0);
+    std::sort (blockMicros.begin(), blockMicros.end());
+    auto percentile = [&] (double p) { return blockMicros[(size_t) (p * (double) (blockMicros.size() - 1))]; };
+
+    std::cout << "Replayed " << blockMicros.size() << " blocks (" << sampleTime / reader.getSampleRate() << " s), "
+              << numEventsIn << " events in, " << numEventsOut << " events out" << std::endl;
+    std::cout << "Block time (us): mean " << totalMicros / (double) blockMicros.size() << ", median "
+              << percentile (0.5) << ", p99 " << percentile (0.99) << ", max " << blockMicros.back() << std::endl;
+    if (reader.getNumGaps() > 0)
+        std::cout << "Warning: the journal has " << reader.getNumGaps() << " gap(s) where blocks were dropped"
+                  << std::endl;
+    return 0;
+}
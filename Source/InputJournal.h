@@ -0,0 +1,163 @@
+#pragma once
+
+#include "SpscRing.h"
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <array>
+#include <atomic>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Always-on recorder of everything that reaches processBlock, so a glitch on stage can be replayed exactly.
+//
+// processBlock copies each block's length and its short MIDI events into a lock-free ring; a background thread
+// writes them to compact binary journal files (LumatoneInterpreter/journal/*.ltj), starting a new file past
+// maxFileBytes. Every instance names its files with a prefix of its own and keeps the newest maxFiles of them, so
+// one never deletes a file another is still writing. SysEx is not recorded, since the processor ignores it.
+//
+// Each file starts with the processor's settings and preset bank as they were at prepare, followed by the controls
+// that have changed since, and the controls are journalled again whenever processBlock sees them change. Replay
+// applies them between blocks, just as processBlock picks them up at the start of one, so it runs with the settings
+// of the performance rather than today's.
+//
+// File layout (little-endian): "LTJ1", uint32 sample rate, then records, each starting with a type byte:
+//   1 block:     uint32 numSamples, uint16 numEvents, numEvents x (uint16 samplePosition, uint8 size, uint8[3] data)
+//   2 idle run:  uint32 numSamples, uint32 count        -- `count` consecutive blocks without events
+//   3 gap:       uint32 numBlocks                       -- blocks lost somewhere in the batch (older journals)
+//   4 settings:  uint32 numBytes, UTF-8 XML             -- see LumatoneInterpreterProcessor::createJournalSnapshot
+//   5 control:   uint8 Control, int32 value             -- takes effect from the next block
+//   6 lost:      uint32 numBlocks, uint32 numSamples    -- blocks lost right here because the ring was full
+// An event's size byte carries the device it came from (see LumatoneInterpreterProcessor::processDevices) in its
+// high nibble, which is zero in journals from before there were several. Journals from before settings were
+// recorded have neither of the last two.
+class InputJournal : private juce::Thread
+{
+public:
+    static constexpr juce::int64 maxFileBytes = 8 * 1024 * 1024;
+    static constexpr int maxFiles = 10;
+
+    InputJournal();
+    ~InputJournal() override;
+
+    // Directory the journal files go in, unless setDirectory picks another (from the next prepare on)
+    static juce::File getJournalDirectory();
+    void setDirectory (const juce::File& directory);
+
+    // On by default; replaying a journal turns it off so the replay isn't journalled too
+    void setEnabled (bool shouldBeEnabled) { m_enabled = shouldBeEnabled; }
+    bool isEnabled() const { return m_enabled.load (std::memory_order_relaxed); }
+
+    // What processBlock acts on besides its input. Floats are journalled as their bits; a program request from a
+    // restored host state, which keeps the parameters it restored, has programKeepsParameters set.
+    enum class Control : juce::uint8
+    {
+        program,
+        tuning,
+        velocityPower,
+        outputMode,
+        adaptiveTuning,
+        attackWindowMs,
+        attackMaxSamples,
+        numControls
+    };
+    static constexpr juce::int32 programKeepsParameters = 1 << 16;
+
+    // Audio thread (prepare from wherever prepareToPlay is called). A control is recorded ahead of the block it
+    // applies to; recordControl returns false if the ring is full.
+    void prepare (double sampleRate, const juce::String& settings);
+    bool recordControl (Control control, juce::int32 value);
+    void recordBlock (const juce::MidiBuffer& midi, std::span<const juce::MidiBuffer> otherDevices, int numSamples);
+
+    // Reads a journal back one block at a time
+    class Reader
+    {
+    public:
+        explicit Reader (const juce::File& file);
+
+        bool isValid() const { return m_sampleRate > 0; }
+        double getSampleRate() const { return m_sampleRate; }
+
+        // Places where blocks were lost. The lost time comes back from readNextBlock as blocks without events, so
+        // the replay's timing stays in step with the performance.
+        int getNumGaps() const { return m_numGaps; }
+
+        // The settings snapshot the file starts with, or nullptr for journals without one
+        const juce::XmlElement* getSettings() const { return m_settings.get(); }
+
+        // Fills deviceMidi[d] with the next block's events from device d, dropping those of devices beyond the span,
+        // and controls with the control changes to apply before it; returns false at the end of the journal
+        bool readNextBlock (
+            std::span<juce::MidiBuffer> deviceMidi,
+            int& numSamples,
+            std::vector<std::pair<Control, juce::int32>>& controls);
+
+    private:
+        juce::FileInputStream m_input;
+        std::unique_ptr<juce::XmlElement> m_settings;
+        double m_sampleRate = 0.0;
+        int m_idleSamples = 0;
+        int m_idleRemaining = 0;
+        int m_numGaps = 0;
+    };
+
+private:
+    enum class Kind : juce::uint8
+    {
+        prepare,
+        block,
+        event,
+        control,
+        gap
+    };
+
+    struct Entry
+    {
+        Kind kind;
+        juce::uint8 numBytes; // device << 4 | size, as in the file; the Control for a control
+        std::array<juce::uint8, 3> data; // the number of lost blocks for a gap (little-endian, saturating)
+        juce::int32 value; // sample rate, block length, sample position, control value or lost samples
+    };
+
+    static constexpr juce::uint32 capacity = 1 << 16;
+
+    void run() override;
+    void drain();
+    void openNextFile (int sampleRate);
+    void flushIdleRun();
+    void writeBlock (int numSamples);
+    void writeControl (Control control, juce::int32 value);
+    void writeGap (int numBlocks, int numSamples);
+
+    // Filled by the audio thread, drained by the writer thread
+    SpscRing<Entry, capacity> m_entries;
+    std::atomic<bool> m_enabled {true};
+
+    // Audio thread: blocks that didn't fit, journalled as a gap ahead of the next block that does
+    juce::uint32 m_lostBlocks = 0;
+    juce::int64 m_lostSamples = 0;
+
+    // Settings passed to the latest prepare and the directory to use, which the writer picks up with its entry
+    juce::CriticalSection m_settingsLock;
+    juce::String m_pendingSettings;
+    juce::File m_pendingDirectory;
+
+    // Writer thread state. m_settings and m_latestControls are written at the start of every file, so each one
+    // replays on its own.
+    std::unique_ptr<juce::FileOutputStream> m_output;
+    juce::File m_directory;
+    const juce::String m_filePrefix;
+    juce::String m_settings;
+    std::array<std::optional<juce::int32>, (size_t) Control::numControls> m_latestControls;
+    int m_sampleRate = 0;
+    int m_idleSamples = 0;
+    juce::uint32 m_idleCount = 0;
+    std::vector<Entry> m_pendingEvents;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (InputJournal)
+};
+
+// Feeds a journal back through a fresh processor block by block, reporting the processing time per block.
+// Returns the process exit code.
+int runJournalReplay (const juce::File& file, bool printOutput);
@@ -0,0 +1,274 @@
+#include "LatencyHarness.h"
+
+#include "Plugin.h"
+
+#include <juce_audio_utils/juce_audio_utils.h>
+
+#include <numeric>
+#include <optional>
+
+namespace
+{
+constexpr double sampleRate = 48000.0;
+
+// Stands in for a sound card: calls back every bufferSize samples in real time
+class HarnessAudioDevice
+: public juce::AudioIODevice
+, private juce::Thread
+{
+public:
+    HarnessAudioDevice (int bufferSize, double load)
+    : AudioIODevice ("Latency Harness", "Latency Harness")
+    , Thread ("Latency Harness Audio")
+    , m_bufferSize (bufferSize)
+    , m_load (load)
+    {}
+
+    ~HarnessAudioDevice() override { stop(); }
+
+    juce::StringArray getOutputChannelNames() override { return {"Left", "Right"}; }
+    juce::StringArray getInputChannelNames() override { return {}; }
+    juce::Array<double> getAvailableSampleRates() override { return {sampleRate}; }
+    juce::Array<int> getAvailableBufferSizes() override { return {m_bufferSize}; }
+    int getDefaultBufferSize() override { return m_bufferSize; }
+
+    juce::String open (const juce::BigInteger&, const juce::BigInteger&, double, int) override { return {}; }
+    void close() override {}
+    bool isOpen() override { return true; }
+
+    void start (juce::AudioIODeviceCallback* callback) override
+    {
+        m_callback = callback;
+        m_callback->audioDeviceAboutToStart (this);
+        startThread (juce::Thread::Priority::highest);
+    }
+
+    void stop() override
+    {
+        stopThread (2000);
+        if (m_callback != nullptr)
+            m_callback->audioDeviceStopped();
+        m_callback = nullptr;
+    }
+
+    bool isPlaying() override { return m_callback != nullptr; }
+    juce::String getLastError() override { return {}; }
+    int getCurrentBufferSizeSamples() override { return m_bufferSize; }
+    double getCurrentSampleRate() override { return sampleRate; }
+    int getCurrentBitDepth() override { return 32; }
+
+    juce::BigInteger getActiveOutputChannels() const override
+    {
+        juce::BigInteger channels;
+        channels.setRange (0, 2, true);
+        return channels;
+    }
+
+    juce::BigInteger getActiveInputChannels() const override { return {}; }
+    int getOutputLatencyInSamples() override { return 0; }
+    int getInputLatencyInSamples() override { return 0; }
+
+private:
+    void run() override
+    {
+        juce::AudioBuffer<float> buffer (2, m_bufferSize);
+        auto periodMs = m_bufferSize / sampleRate * 1000.0;
+        auto nextCallback = juce::Time::getMillisecondCounterHiRes() + periodMs;
+
+        while (! threadShouldExit()) {
+            for (auto remaining = nextCallback - juce::Time::getMillisecondCounterHiRes(); remaining > 0.0;
+                 remaining = nextCallback - juce::Time::getMillisecondCounterHiRes()) {
+                if (remaining > 2.0)
+                    juce::Thread::sleep ((int) remaining - 1);
+                else
+                    juce::Thread::yield();
+            }
+            nextCallback += periodMs;
+
+            // The rest of the audio graph, as far as the processor can tell
+            auto busyUntil = juce::Time::getMillisecondCounterHiRes() + m_load * periodMs;
+            while (juce::Time::getMillisecondCounterHiRes() < busyUntil) {}
+
+            m_callback->audioDeviceIOCallbackWithContext (
+                nullptr, 0, buffer.getArrayOfWritePointers(), buffer.getNumChannels(), m_bufferSize, {});
+        }
+    }
+
+    int m_bufferSize;
+    double m_load;
+    juce::AudioIODeviceCallback* m_callback = nullptr;
+};
+
+// Collects the arrival times of the processor's note-ons
+class CaptureCallback : public juce::MidiInputCallback
+{
+public:
+    void handleIncomingMidiMessage (juce::MidiInput*, const juce::MidiMessage& message) override
+    {
+        if (message.isNoteOn()) {
+            const juce::ScopedLock sl (m_lock);
+            m_arrivals.push_back (juce::Time::getMillisecondCounterHiRes());
+        }
+    }
+
+    std::vector<double> takeArrivals()
+    {
+        const juce::ScopedLock sl (m_lock);
+        return std::exchange (m_arrivals, {});
+    }
+
+private:
+    juce::CriticalSection m_lock;
+    std::vector<double> m_arrivals;
+};
+
+std::optional<juce::MidiDeviceInfo>
+findDevice (const juce::Array<juce::MidiDeviceInfo>& devices, const juce::String& name)
+{
+    for (const auto& device : devices) {
+        if (device.name.containsIgnoreCase (name))
+            return device;
+    }
+    return std::nullopt;
+}
+
+juce::String option (const juce::StringArray& args, const juce::String& name, const juce::String& fallback)
+{
+    if (auto index = args.indexOf (name); index >= 0 && index + 1 < args.size())
+        return args[index + 1].unquoted();
+    return fallback;
+}
+
+// Sends `numEvents` note-ons (and matching note-offs) in the rhythm of fast playing, up to six keys held at once,
+// and returns when they were sent
+std::vector<double> playNotes (juce::MidiOutput& output, int numEvents, juce::Random& random)
+{
+    std::vector<double> sent;
+    std::vector<std::pair<int, int>> held;
+
+    for (int i = 0; i < numEvents; ++i) {
+        if (held.size() >= 6) {
+            output.sendMessageNow (juce::MidiMessage::noteOff (held.front().first, held.front().second));
+            held.erase (held.begin());
+        }
+
+        // Keys already down aren't pressed again, so every note-on in gets exactly one note-on out
+        std::pair<int, int> key;
+        do {
+            key = {2 + random.nextInt (5), random.nextInt (56)};
+        } while (std::find (held.begin(), held.end(), key) != held.end());
+
+        sent.push_back (juce::Time::getMillisecondCounterHiRes());
+        auto velocity = (juce::uint8) (1 + random.nextInt (127));
+        output.sendMessageNow (juce::MidiMessage::noteOn (key.first, key.second, velocity));
+        held.push_back (key);
+
+        juce::Thread::sleep (2 + random.nextInt (7));
+    }
+
+    for (auto [channel, note] : held)
+        output.sendMessageNow (juce::MidiMessage::noteOff (channel, note));
+
+    return sent;
+}
+} // namespace
+
+int runLatencyHarness (const juce::StringArray& args)
+{
+    auto injectName = option (args, "--inject-port", "Midi Through Port-0");
+    auto captureName = option (args, "--capture-port", "Midi Through Port-1");
+    auto numEvents = option (args, "--events", "300").getIntValue();
+
+    juce::Array<int> bufferSizes;
+    auto bufferSizeList = option (args, "--buffer-sizes", "32,64,128,256,512");
+    for (const auto& size : juce::StringArray::fromTokens (bufferSizeList, ",", ""))
+        bufferSizes.add (size.getIntValue());
+
+    juce::Array<double> loads;
+    for (const auto& load : juce::StringArray::fromTokens (option (args, "--loads", "0,0.5,0.9"), ",", ""))
+        loads.add (juce::jlimit (0.0, 0.99, load.getDoubleValue()));
+
+    auto inputs = juce::MidiInput::getAvailableDevices();
+    auto outputs = juce::MidiOutput::getAvailableDevices();
+    auto injectOut = findDevice (outputs, injectName);
+    auto injectIn = findDevice (inputs, injectName);
+    auto captureOut = findDevice (outputs, captureName);
+    auto captureIn = findDevice (inputs, captureName);
+    if (! injectOut || ! injectIn || ! captureOut || ! captureIn) {
+        std::cerr << "Need loopback MIDI ports \"" << injectName << "\" and \"" << captureName
+                  << "\" (on Linux: sudo modprobe snd-seq-dummy ports=2)" << std::endl;
+        return 1;
+    }
+
+    auto processor = std::make_unique<LumatoneInterpreterProcessor>();
+    processor->getInputJournal().setEnabled (false);
+
+    // The same wiring StandalonePluginHolder sets up through its AudioDeviceManager
+    juce::AudioProcessorPlayer player;
+    player.setProcessor (processor.get());
+
+    CaptureCallback capture;
+    auto injector = juce::MidiOutput::openDevice (injectOut->identifier);
+    auto playerIn = juce::MidiInput::openDevice (injectIn->identifier, &player);
+    auto playerOut = juce::MidiOutput::openDevice (captureOut->identifier);
+    auto captureInput = juce::MidiInput::openDevice (captureIn->identifier, &capture);
+    if (injector == nullptr || playerIn == nullptr || playerOut == nullptr || captureInput == nullptr) {
+        std::cerr << "Failed to open the loopback MIDI ports" << std::endl;
+        return 1;
+    }
+    player.setMidiOutput (playerOut.get());
+    playerIn->start();
+    captureInput->start();
+
+    std::cout << "buffer   load      n     min     p50     p95     p99     max  jitter (ms)" << std::endl;
+
+    juce::Random random (42);
+    bool complete = true;
+    for (auto bufferSize : bufferSizes) {
+        for (auto load : loads) {
+            HarnessAudioDevice device (bufferSize, load);
+            device.start (&player);
+            juce::Thread::sleep (200);
+            capture.takeArrivals();
+
+            auto sent = playNotes (*injector, numEvents, random);
+            juce::Thread::sleep (500);
+            auto arrivals = capture.takeArrivals();
+            device.stop();
+
+            // MIDI keeps its order end to end, so the n-th note-on out belongs to the n-th note-on in
+            std::vector<double> latencies;
+            for (size_t i = 0; i < std::min (sent.size(), arrivals.size()); ++i)
+                latencies.push_back (arrivals[i] - sent[i]);
+
+            if (latencies.size() != sent.size()) {
+                std::cerr << "  " << sent.size() - latencies.size() << " note(s) never came back" << std::endl;
+                complete = false;
+            }
+            if (latencies.empty())
+                continue;
+
+            std::sort (latencies.begin(), latencies.end());
+            auto at = [&] (double p) { return latencies[(size_t) (p * (double) (latencies.size() - 1))]; };
+            auto mean = std::accumulate (latencies.begin(), latencies.end(), 0.0) / (double) latencies.size();
+            auto variance = std::accumulate (latencies.begin(), latencies.end(), 0.0, [mean] (double sum, double x) {
+                return sum + (x - mean) * (x - mean);
+            }) / (double) latencies.size();
+
+            std::cout << juce::String (bufferSize).paddedLeft (' ', 6) << juce::String (load, 2).paddedLeft (' ', 7)
+                      << juce::String ((int) latencies.size()).paddedLeft (' ', 7)
+                      << juce::String (latencies.front(), 2).paddedLeft (' ', 8)
+                      << juce::String (at (0.5), 2).paddedLeft (' ', 8)
+                      << juce::String (at (0.95), 2).paddedLeft (' ', 8)
+                      << juce::String (at (0.99), 2).paddedLeft (' ', 8)
+                      << juce::String (latencies.back(), 2).paddedLeft (' ', 8)
+                      << juce::String (std::sqrt (variance), 2).paddedLeft (' ', 8) << std::endl;
+        }
+    }
+
+    playerIn->stop();
+    captureInput->stop();
+    player.setMidiOutput (nullptr);
+    player.setProcessor (nullptr);
+    return complete ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+// Measures key-to-output MIDI latency and jitter through the same path the Standalone app uses
+// (MidiInput -> AudioProcessorPlayer -> processor -> MidiOutput), with no audio or MIDI hardware.
+//
+// A paced fake audio device stands in for the sound card, optionally burning part of each period to simulate load
+// from the rest of the audio graph. Lumatone-style notes are sent into one MIDI loopback port and the processor's
+// output is captured from another; on a plain Linux box `sudo modprobe snd-seq-dummy ports=2` provides both.
+//
+// Options (all optional):
+//   --buffer-sizes 32,64,128,256,512    --loads 0,0.5,0.9    --events 300
+//   --inject-port "Midi Through Port-0"  --capture-port "Midi Through Port-1"
+//
+// Returns the process exit code.
+int runLatencyHarness (const juce::StringArray& args);
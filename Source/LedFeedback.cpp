@@ -0,0 +1,154 @@
+#include "LedFeedback.h"
+
+#include "TuningTable.h"
+
+namespace
+{
+// Lumatone SysEx framing: manufacturer id, then board (1-5), command and its data
+constexpr juce::uint8 lumatoneManufacturerId[] = {0x00, 0x21, 0x50};
+constexpr juce::uint8 changeKeyColourCommand = 0x01;
+
+constexpr int tickMs = 10;
+constexpr int messagesPerTick = std::max (1, LedFeedback::maxMessagesPerSecond * tickMs / 1000);
+} // namespace
+
+LedFeedback::LedFeedback() : Thread ("LED Feedback")
+{
+    for (int board = 0; board < numBoards; ++board) {
+        for (int note = 0; note < keysPerBoard; ++note) {
+            auto index = (size_t) (board * keysPerBoard + note);
+            m_wantedColours[index] = layoutColour (board, note);
+            m_sentColours[index] = layoutColour (board, note);
+        }
+    }
+}
+
+LedFeedback::~LedFeedback()
+{
+    stopThread (1000);
+}
+
+void LedFeedback::setOutput (std::unique_ptr<juce::MidiOutput> output)
+{
+    {
+        const juce::ScopedLock sl (m_outputLock);
+        m_output = std::move (output);
+    }
+
+    if (! isThreadRunning())
+        startThread (juce::Thread::Priority::low);
+}
+
+void LedFeedback::setEnabled (bool shouldBeEnabled)
+{
+    m_enabled = shouldBeEnabled;
+
+    if (! shouldBeEnabled) {
+        for (int board = 0; board < numBoards; ++board) {
+            for (int note = 0; note < keysPerBoard; ++note)
+                m_wantedColours[(size_t) (board * keysPerBoard + note)] = layoutColour (board, note);
+        }
+    }
+}
+
+void LedFeedback::voiceStarted (int channelIn, int note, int channelOut, bool shared)
+{
+    auto index = keyIndex (channelIn, note);
+    if (! m_enabled.load (std::memory_order_relaxed) || index < 0)
+        return;
+
+    auto colour = shared ? juce::Colours::red : juce::Colour::fromHSV ((channelOut - 2) / 15.0f, 0.8f, 1.0f, 1.0f);
+    m_wantedColours[(size_t) index].store (colour.getARGB() & 0xffffff, std::memory_order_relaxed);
+}
+
+void LedFeedback::voiceStopped (int channelIn, int note)
+{
+    auto index = keyIndex (channelIn, note);
+    if (! m_enabled.load (std::memory_order_relaxed) || index < 0)
+        return;
+
+    m_wantedColours[(size_t) index].store (layoutColour (channelIn - 2, note), std::memory_order_relaxed);
+}
+
+juce::uint32 LedFeedback::layoutColour (int board, int note)
+{
+    auto [x, y] = lumaNoteToLocalCoord (note);
+    x += 5 * board - 5 * 2;
+    y += 2 * board - 2 * 2 - 5;
+
+    auto key31 = ((5 * x + 3 * y + 8) % 31 + 31) % 31;
+    auto isIn = [key31] (std::initializer_list<int> keys) {
+        return std::find (keys.begin(), keys.end(), key31) != keys.end();
+    };
+
+    if (isIn ({0, 5, 8, 13, 18, 21, 26}))
+        return 0xdfdfdf;
+    if (isIn ({2, 7, 10, 15, 20, 23, 28}))
+        return 0x176991;
+    if (isIn ({29, 3, 6, 11, 16, 19, 24}))
+        return 0x916c17;
+    if (isIn ({12, 25, 30}))
+        return 0x783fa7;
+    if (isIn ({14, 27, 1}))
+        return 0xa7453c;
+    if (isIn ({4, 9, 17, 22}))
+        return 0xb35e96;
+    return 0x000000;
+}
+
+void LedFeedback::run()
+{
+    while (! threadShouldExit()) {
+        wait (tickMs);
+
+        const juce::ScopedLock sl (m_outputLock);
+        if (m_output == nullptr)
+            continue;
+
+        // Round-robin from where the last tick stopped, so a busy board can't starve the others
+        int sent = 0;
+        for (int i = 0; i < numBoards * keysPerBoard && sent < messagesPerTick; ++i) {
+            auto index = (size_t) m_nextKey;
+            m_nextKey = (m_nextKey + 1) % (numBoards * keysPerBoard);
+
+            auto wanted = m_wantedColours[index].load (std::memory_order_relaxed);
+            if (wanted != m_sentColours[index]) {
+                sendKeyColour ((int) index / keysPerBoard, (int) index % keysPerBoard, wanted);
+                m_sentColours[index] = wanted;
+                ++sent;
+            }
+        }
+    }
+}
+
+void LedFeedback::sendKeyColour (int board, int note, juce::uint32 rgb)
+{
+    auto red = (juce::uint8) ((rgb >> 16) & 0xff);
+    auto green = (juce::uint8) ((rgb >> 8) & 0xff);
+    auto blue = (juce::uint8) (rgb & 0xff);
+
+    // Colour components go out as high and low nibbles to stay within 7-bit data bytes
+    const juce::uint8 data[] = {
+        lumatoneManufacturerId[0],
+        lumatoneManufacturerId[1],
+        lumatoneManufacturerId[2],
+        (juce::uint8) (board + 1),
+        changeKeyColourCommand,
+        (juce::uint8) note,
+        (juce::uint8) (red >> 4),
+        (juce::uint8) (red & 0xf),
+        (juce::uint8) (green >> 4),
+        (juce::uint8) (green & 0xf),
+        (juce::uint8) (blue >> 4),
+        (juce::uint8) (blue & 0xf),
+    };
+    m_output->sendMessageNow (juce::MidiMessage::createSysExMessage (data, (int) sizeof (data)));
+}
+
+int LedFeedback::keyIndex (int channelIn, int note)
+{
+    auto board = channelIn - 2;
+    if (board < 0 || board >= numBoards || note < 0 || note >= keysPerBoard)
+        return -1;
+    return board * keysPerBoard + note;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <juce_audio_devices/juce_audio_devices.h>
+
+#include <array>
+#include <atomic>
+
+// Lights up sounding keys on the Lumatone, coloured by the output channel they were given (red on every key of a
+// channel shared by more than one voice, for as long as it is), and puts the layout colour back on release.
+//
+// The audio thread only stores the colour it wants for a key. A background thread compares that against what it
+// last sent and sends SysEx for whatever differs, a few messages per tick. Repeated changes to a key in between
+// collapse into a single message, and the Lumatone's slow MIDI input never holds up note output, which goes out
+// through a different port.
+class LedFeedback : private juce::Thread
+{
+public:
+    static constexpr int numBoards = 5;
+    static constexpr int keysPerBoard = 56;
+
+    // SysEx sent per second at most; the Lumatone drops messages if they arrive faster than it can apply them
+    static constexpr int maxMessagesPerSecond = 200;
+
+    LedFeedback();
+    ~LedFeedback() override;
+
+    // Where the SysEx goes: the Lumatone's own MIDI port in the Standalone app, or any other output (a virtual
+    // loopback port, say) to watch the traffic. Message thread only.
+    void setOutput (std::unique_ptr<juce::MidiOutput> output);
+
+    // Turning feedback off puts every key back to its layout colour
+    void setEnabled (bool shouldBeEnabled);
+    bool isEnabled() const { return m_enabled.load(); }
+
+    // Audio thread. channelIn is the Lumatone input channel (board + 2, as in luma.ltn).
+    void voiceStarted (int channelIn, int note, int channelOut, bool shared);
+    void voiceStopped (int channelIn, int note);
+
+    // The colour lumamap.py gives the key in luma.ltn
+    static juce::uint32 layoutColour (int board, int note);
+
+private:
+    void run() override;
+    void sendKeyColour (int board, int note, juce::uint32 rgb);
+    static int keyIndex (int channelIn, int note);
+
+    std::array<std::atomic<juce::uint32>, numBoards * keysPerBoard> m_wantedColours;
+    std::array<juce::uint32, numBoards * keysPerBoard> m_sentColours;
+    std::atomic<bool> m_enabled {false};
+
+    juce::CriticalSection m_outputLock;
+    std::unique_ptr<juce::MidiOutput> m_output;
+    int m_nextKey = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LedFeedback)
+};
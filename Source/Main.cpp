@@ -1,4 +1,7 @@
+#include "InputJournal.h"
+#include "LatencyHarness.h"
 #include "Plugin.h"
+#include "RealtimeCheck.h"
 
 // Include order matters here.
 // clang-format off
@@ -8,32 +11,65 @@
 
 using namespace juce;
 
-class LumatoneInterpreterApplication : public JUCEApplication
+class LumatoneInterpreterApplication
+: public JUCEApplication
+, private Timer
 {
 public:
     LumatoneInterpreterApplication() {}
 
     void initialise (const String& commandLineParameters) override
     {
+#if LUMATONE_REALTIME_CHECKS
+        if (commandLineParameters.contains ("--realtime-check")) {
+            setApplicationReturnValue (runRealtimeCheck());
+            quit();
+            return;
+        }
+#endif
+
+        auto args = StringArray::fromTokens (commandLineParameters, true);
+
+        // --replay <journal> [--print] feeds a recorded input journal through the processor and exits
+        if (args.contains ("--replay")) {
+            auto index = args.indexOf ("--replay");
+            auto file = File::getCurrentWorkingDirectory().getChildFile (args[index + 1].unquoted());
+            setApplicationReturnValue (runJournalReplay (file, args.contains ("--print")));
+            quit();
+            return;
+        }
+
+        // --latency-harness [options] measures MIDI latency through loopback ports and exits (see LatencyHarness.h)
+        if (args.contains ("--latency-harness")) {
+            setApplicationReturnValue (runLatencyHarness (args));
+            quit();
+            return;
+        }
+
         filterWindow =
             std::make_unique<StandaloneFilterWindow> (getApplicationName(), juce::Colours::black, nullptr, true);
         filterWindow->setTitleBarButtonsRequired (DocumentWindow::allButtons, false);
 
         // Set default device settings
-        setDefaultDeviceSettings();
+        setDefaultDeviceSettings (commandLineParameters);
 
         filterWindow->setVisible (true);
         filterWindow->setResizable (true, true);
     }
 
-    void shutdown() override {}
+    void shutdown() override
+    {
+        stopTimer();
+        extraLumatoneInputs.clear();
+        filterWindow.reset();
+    }
 
     const String getApplicationName() override { return juce::String ("Lumatone Interpreter"); }
     const String getApplicationVersion() override { return String ("0.01"); }
     bool moreThanOneInstanceAllowed() override { return true; }
 
 private:
-    void setDefaultDeviceSettings()
+    void setDefaultDeviceSettings (const String& commandLineParameters)
     {
         if (auto* pluginHolder = filterWindow->getPluginHolder()) {
             auto& deviceManager = pluginHolder->deviceManager;
@@ -42,18 +78,43 @@ private:
             auto currentSetup = deviceManager.getAudioDeviceSetup();
             currentSetup.bufferSize = 64;
 
-            // Try to set "Lumatone" as MIDI input device if available
+            // The first "Lumatone" MIDI input goes through the device manager like any other. Further ones get a
+            // queue of their own, attached to the processor (see attachProcessor), so each has its own voice table.
             auto midiInputs = MidiInput::getAvailableDevices();
+            int numLumatones = 0;
             for (const auto& input : midiInputs) {
-                if (input.name.containsIgnoreCase ("Lumatone")) {
+                if (! input.name.containsIgnoreCase ("Lumatone"))
+                    continue;
+
+                if (numLumatones == 0) {
                     deviceManager.setMidiInputDeviceEnabled (input.identifier, true);
-                    break;
                 }
+                else if (numLumatones < LumatoneInterpreterProcessor::maxDevices) {
+                    deviceManager.setMidiInputDeviceEnabled (input.identifier, false);
+                    auto queue = std::make_unique<DeviceInput>();
+                    if (auto opened = MidiInput::openDevice (input.identifier, queue.get())) {
+                        opened->start();
+                        extraLumatoneQueues.push_back (std::move (queue));
+                        extraLumatoneInputs.push_back (std::move (opened));
+                    }
+                }
+                ++numLumatones;
             }
 
+            // Key lighting goes straight back to the Lumatone. --led-output <name> picks a different port, e.g. a
+            // virtual loopback to watch the SysEx traffic.
+            auto args = StringArray::fromTokens (commandLineParameters, true);
+            ledOutputName = "Lumatone";
+            if (auto index = args.indexOf ("--led-output"); index >= 0 && index + 1 < args.size())
+                ledOutputName = args[index + 1].unquoted();
+
+            attachProcessor();
+
+            // "Reset to default state" replaces the processor; the new one needs the same wiring
+            startTimer (250);
+
             // Try to set "IAC Bus 1" as default MIDI output device if available
-            auto midiOutputs = MidiOutput::getAvailableDevices();
-            for (const auto& output : midiOutputs) {
+            for (const auto& output : MidiOutput::getAvailableDevices()) {
                 if (output.name.containsIgnoreCase ("IAC Driver Bus 1")) {
                     deviceManager.setDefaultMidiOutputDevice (output.identifier);
                     break;
@@ -65,7 +126,38 @@ private:
         }
     }
 
+    // Connects the processor to the extra Lumatones' queues and the key lighting output, unless it already is
+    void attachProcessor()
+    {
+        auto* pluginHolder = filterWindow->getPluginHolder();
+        if (pluginHolder == nullptr)
+            return;
+
+        auto* processor = dynamic_cast<LumatoneInterpreterProcessor*> (pluginHolder->processor.get());
+        if (processor == nullptr || processor == attachedProcessor.get())
+            return;
+
+        for (size_t i = 0; i < extraLumatoneQueues.size(); ++i)
+            processor->attachDeviceInput ((int) i + 1, extraLumatoneQueues[i].get());
+
+        for (const auto& output : MidiOutput::getAvailableDevices()) {
+            if (output.name.containsIgnoreCase (ledOutputName)) {
+                processor->getLedFeedback().setOutput (MidiOutput::openDevice (output.identifier));
+                break;
+            }
+        }
+
+        attachedProcessor = processor;
+    }
+
+    void timerCallback() override { attachProcessor(); }
+
+    // The queues outlive any processor they are attached to, and the inputs writing into them
+    std::vector<std::unique_ptr<DeviceInput>> extraLumatoneQueues; // devices 1 and up
     std::unique_ptr<juce::StandaloneFilterWindow> filterWindow;
+    std::vector<std::unique_ptr<juce::MidiInput>> extraLumatoneInputs;
+    WeakReference<LumatoneInterpreterProcessor> attachedProcessor;
+    String ledOutputName;
 };
 
 START_JUCE_APPLICATION (LumatoneInterpreterApplication)
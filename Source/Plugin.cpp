@@ -1,17 +1,48 @@
 #include "Plugin.h"
 
 #include "Editor.h"
+#include "RealtimeCheck.h"
+#include "Trace.h"
 
 #include <juce_audio_basics/juce_audio_basics.h>
 
+#include <bit>
+
 LumatoneInterpreterProcessor::LumatoneInterpreterProcessor() : AudioProcessor (getBusesProperties())
 {
+    for (auto& device : m_devices) {
+        for (auto& notes : device.noteToChannel)
+            notes.fill (noChannel);
+        for (auto& notes : device.noteToSlot)
+            notes.fill (-1);
+        for (auto& powers : device.fixupPowers) {
+            for (auto& power : powers)
+                power = 1.0f;
+        }
+    }
+    m_controllerValues.fill (-1);
+    for (auto& sent : m_sentControllers)
+        sent.fill (-1);
+    m_channelLastUsed.fill (-1);
+
     // Initialize available tuning systems
     m_availableTunings.push_back (
         TuningSystem ("31 EDO", std::pow (2.0, 5.0 / 31.0), std::pow (2.0, 3.0 / 31.0), "31-tone equal temperament"));
     m_availableTunings.push_back (
         TuningSystem ("31-esque Regression", 1.118755, 1.068773, "Regression-based approximation of 31 EDO"));
 
+    juce::NormalisableRange<float> velocityPowerRange (0.1f, 10.0f, 0.01f);
+    velocityPowerRange.setSkewForCentre (1.0f);
+    addParameter (
+        m_velocityPowerParam = new juce::AudioParameterFloat (
+            juce::ParameterID {"velocityPower", 1}, "Global Velocity Exp", velocityPowerRange, 1.0f));
+
+    juce::StringArray tuningNames;
+    for (const auto& tuning : m_availableTunings)
+        tuningNames.add (tuning.name);
+    addParameter (
+        m_tuningParam = new juce::AudioParameterChoice (juce::ParameterID {"tuning", 1}, "Tuning", tuningNames, 0));
+
     // Initialize the velocity fixup file path
     auto appDataDir = juce::File::getSpecialLocation (juce::File::userApplicationDataDirectory);
     auto lumatoneDir = appDataDir.getChildFile ("LumatoneInterpreter");
@@ -21,6 +52,14 @@ LumatoneInterpreterProcessor::LumatoneInterpreterProcessor() : AudioProcessor (g
     m_velocityFixupFile = lumatoneDir.getChildFile ("velocity_fixups.xml");
 
     loadVelocityFixups();
+    m_savedParameters = m_lastSeenParameters = getParametersToSave();
+
+    // Compiled after the settings are loaded, which a bank without a file falls back on. The program that was last in
+    // use comes back with the parameters as they were saved, not as the preset sets them.
+    m_presetBank.load (m_availableTunings, getCurrentTuningIndex(), getGlobalVelocityPower());
+    auto program = m_currentProgram.load();
+    selectPreset (program >= 0 && program < m_presetBank.getNumPresets() ? program : 0, false);
+    startTimerHz (20);
 }
 
 bool LumatoneInterpreterProcessor::isBusesLayoutSupported (const BusesLayout&) const
@@ -28,108 +67,695 @@ bool LumatoneInterpreterProcessor::isBusesLayoutSupported (const BusesLayout&) c
     return true;
 }
 
-void LumatoneInterpreterProcessor::prepareToPlay (double /*newSampleRate*/, int /*samplesPerBlock*/)
+void LumatoneInterpreterProcessor::prepareToPlay (double newSampleRate, int /*samplesPerBlock*/)
 {
+    m_sampleRate = newSampleRate;
+
+    // A new journal file starts from these settings, so only changes from here on need recording
+    m_journalledControls = getBlockControls();
+    m_inputJournal.prepare (newSampleRate, createJournalSnapshot());
+
+    // A note produces at most six short messages and a channel 1 controller one per output channel plus itself, so
+    // the worst block is every device's queue full of controllers: 16 messages of 9 bytes (time, size, data) each
+    m_midiOut.ensureSize ((size_t) maxDevices * DeviceInput::capacity * 16 * 9);
+
+    for (auto& midi : m_otherDeviceMidi)
+        midi.ensureSize (DeviceInput::capacity * 16);
+
+    for (auto& device : m_devices) {
+        for (auto& attack : device.pendingAttacks)
+            attack.clear();
+    }
+
+    // Whatever the synth had before, it may not have now
+    for (auto& sent : m_sentControllers)
+        sent.fill (-1);
+
     reset();
 }
 
 void LumatoneInterpreterProcessor::releaseResources() {}
 
 void LumatoneInterpreterProcessor::processBlock (juce::AudioBuffer<float>& audioIn, juce::MidiBuffer& midiMessages)
+{
+    LUMATONE_TRACE_SCOPE ("processBlock");
+    LUMATONE_REALTIME_SCOPE ("processBlock");
+
+    for (size_t i = 0; i < m_otherDeviceMidi.size(); ++i) {
+        if (auto* input = m_deviceInputs[i + 1].load())
+            input->readBlock (m_otherDeviceMidi[i], audioIn.getNumSamples(), m_sampleRate);
+        else
+            m_otherDeviceMidi[i].clear();
+    }
+
+    processDevices (audioIn, midiMessages, m_otherDeviceMidi);
+}
+
+void LumatoneInterpreterProcessor::processDevices (
+    juce::AudioBuffer<float>& audioIn,
+    juce::MidiBuffer& midiMessages,
+    std::span<const juce::MidiBuffer> otherDevices)
 {
     audioIn.clear();
 
-    juce::MidiBuffer midiOut;
-    for (auto event : midiMessages) {
-        juce::MidiMessage message = event.getMessage();
+    auto& midiOut = m_midiOut;
+    midiOut.clear();
 
-        if (message.getChannel() == 1) {
-            // Pass through for things like pitch bend, program change
-            midiOut.addEvent (message, event.samplePosition);
-            continue;
+    auto request = m_requestedProgram.exchange (noProgramRequest);
+    auto program = request == noProgramRequest ? -1 : request >> 1;
+    auto keepsParameters = request != noProgramRequest && (request & 1) != 0;
+    auto programSelected = program >= 0 && selectPreset (program, ! keepsParameters);
+
+    // The block acts on the controls as they are now, and the journal records them ahead of its input, so a replay
+    // that applies them between blocks does exactly the same
+    auto controls = getBlockControls();
+    journalControls (controls, programSelected, keepsParameters);
+    m_inputJournal.recordBlock (midiMessages, otherDevices, audioIn.getNumSamples());
+
+    applyParameters (controls.tuningIndex, controls.velocityPower);
+    m_activeAttackWindowMs = controls.attackWindowMs;
+    m_activeAttackMaxSamples = controls.attackMaxSamples;
+
+    if (auto mode = (OutputMode) controls.outputMode; mode != m_activeOutputMode) {
+        releaseAllVoices (0);
+        m_activeOutputMode = mode;
+        m_mtsTableSent = nullptr;
+    }
+    if (m_activeOutputMode == OutputMode::mts)
+        updateMtsTuning();
+
+    // The devices share the output channels, so their events are merged and handled in time order; otherwise a
+    // channel could be handed to one device's note before another's earlier note has let go of it
+    std::array<juce::MidiBufferIterator, maxDevices> next, end;
+    auto numDevices = std::min (otherDevices.size() + 1, m_devices.size());
+    next[0] = midiMessages.cbegin();
+    end[0] = midiMessages.cend();
+    for (size_t i = 1; i < numDevices; ++i) {
+        next[i] = otherDevices[i - 1].cbegin();
+        end[i] = otherDevices[i - 1].cend();
+    }
+
+    for (;;) {
+        // The earliest pending event; ties go to the lower device
+        size_t device = numDevices;
+        for (size_t i = 0; i < numDevices; ++i) {
+            if (next[i] == end[i])
+                continue;
+            if (device == numDevices || (*next[i]).samplePosition < (*next[device]).samplePosition)
+                device = i;
         }
+        if (device == numDevices)
+            break;
 
-        int initialPressure = 0;
-        if (message.isController()) {
-            if (message.getControllerValue() == 0) {
-                message = juce::MidiMessage::noteOff (message.getChannel(), message.getControllerNumber());
-            }
-            else {
-                if (auto found = m_noteToChannel.find ({message.getChannel(), message.getControllerNumber()});
-                    found != m_noteToChannel.end()) {
-                    message = juce::MidiMessage::aftertouchChange (
-                        message.getChannel(), message.getControllerNumber(), message.getControllerValue());
-                }
-                else {
-                    // As an approximation of velocity, we treat the first nonzero controller value as the note-on
-                    // velocity. Let's see if it works.
-                    initialPressure = message.getControllerValue();
-                    message = juce::MidiMessage::noteOn (
-                        message.getChannel(),
-                        message.getControllerNumber(),
-                        (juce::uint8) message.getControllerValue());
-                }
+        auto event = *next[device]++;
+        for (int i = 0; i < maxDevices; ++i)
+            emitDueAttacks (i, m_blockStartSample + event.samplePosition);
+        processEvent ((int) device, event);
+    }
+
+    auto numSamples = audioIn.getNumSamples();
+    for (int device = 0; device < maxDevices; ++device)
+        emitDueAttacks (device, m_blockStartSample + numSamples - 1);
+    m_blockStartSample += numSamples;
+
+    if (m_activeOutputMode == OutputMode::channelPerVoice)
+        updateAdaptiveTuning (controls.adaptiveTuning, std::max (0, numSamples - 1));
+
+    // Copy rather than swap, so m_midiOut keeps the capacity reserved in prepareToPlay
+    midiMessages.clear();
+    midiMessages.addEvents (midiOut, 0, -1, 0);
+}
+
+void LumatoneInterpreterProcessor::processEvent (int device, const juce::MidiMessageMetadata& event)
+{
+    // SysEx is dropped below anyway; skip it before it gets copied into a (possibly heap-allocated) MidiMessage
+    if (event.numBytes > 3)
+        return;
+
+    auto time = m_blockStartSample + event.samplePosition;
+    juce::MidiMessage message = event.getMessage();
+
+    if (message.getChannel() == 1) {
+        // Program changes switch presets from this event on, and aren't passed to the synth
+        if (message.isProgramChange()) {
+            selectPreset (message.getProgramChangeNumber(), true);
+            return;
+        }
+
+        if (message.isController())
+            fanOutController (message.getControllerNumber(), message.getControllerValue(), event.samplePosition);
+
+        // Pass through for things like pitch bend
+        m_midiOut.addEvent (message, event.samplePosition);
+        return;
+    }
+
+    int initialPressure = 0;
+    if (message.isController()) {
+        auto channelIn = message.getChannel();
+        auto noteIn = message.getControllerNumber();
+        auto pressure = message.getControllerValue();
+
+        if (auto* attack = findPendingAttack (device, channelIn, noteIn)) {
+            if (pressure > 0) {
+                attack->addSample (time, pressure);
+                if (attack->getNumSamples() >= m_activeAttackMaxSamples)
+                    emitAttack (device, *attack, time);
+                return;
             }
+            // Released before the estimate was due; sound it now so the note-off below has a voice to end
+            emitAttack (device, *attack, time);
         }
 
-        if (message.isNoteOn()) {
-            auto noteIn = message.getNoteNumber();
-            auto channelIn = message.getChannel();
-            auto velocity = (float) message.getVelocity();
+        if (pressure == 0) {
+            message = juce::MidiMessage::noteOff (channelIn, noteIn);
+        }
+        else if (findChannel (device, channelIn, noteIn) != noChannel) {
+            message = juce::MidiMessage::aftertouchChange (channelIn, noteIn, pressure);
+        }
+        else if (beginAttack (device, channelIn, noteIn, pressure, time)) {
+            // The note-on goes out once the estimator has seen enough of the attack
+            return;
+        }
+        else {
+            // Estimation is off (or every slot is busy), so the first nonzero value is the velocity
+            initialPressure = pressure;
+            message = juce::MidiMessage::noteOn (channelIn, noteIn, (juce::uint8) pressure);
+        }
+    }
+
+    if (message.isNoteOn()) {
+        startVoice (
+            device,
+            message.getChannel(),
+            message.getNoteNumber(),
+            (float) message.getVelocity(),
+            initialPressure,
+            event.samplePosition);
+    }
+    else if (message.isNoteOff()) {
+        stopVoice (device, message.getChannel(), message.getNoteNumber(), event.samplePosition);
+    }
+    else if (message.isAftertouch()) {
+        sendPressure (
+            device,
+            message.getChannel(),
+            message.getNoteNumber(),
+            message.getAfterTouchValue(),
+            event.samplePosition);
+    }
+}
+
+void LumatoneInterpreterProcessor::timerCallback()
+{
+    // Show the host (and the editor) what a program change switched to
+    if (m_presetParametersPending.exchange (false)) {
+        const auto& preset = m_presetBank.getPreset (m_currentProgram.load());
+        setParameterAsGesture (*m_tuningParam, (float) preset.tuningIndex);
+        setParameterAsGesture (*m_velocityPowerParam, preset.velocityPower);
+    }
+
+    if (auto parameters = getParametersToSave(); parameters != m_savedParameters) {
+        if (parameters == m_lastSeenParameters)
+            saveVelocityFixups();
+        m_lastSeenParameters = parameters;
+    }
+}
+
+void LumatoneInterpreterProcessor::setParameterAsGesture (juce::RangedAudioParameter& parameter, float value)
+{
+    // Bracketed as a gesture, so hosts in touch or latch mode record it
+    parameter.beginChangeGesture();
+    parameter.setValueNotifyingHost (parameter.convertTo0to1 (value));
+    parameter.endChangeGesture();
+}
+
+bool LumatoneInterpreterProcessor::selectPreset (int index, bool syncParameters)
+{
+    if (index < 0 || index >= m_presetBank.getNumPresets())
+        return false;
+
+    m_activePreset = &m_presetBank.getPreset (index);
+    m_activeTuningIndex = m_activePreset->tuningIndex;
+    m_velocityCurve = &m_activePreset->velocityCurve;
+
+    if (syncParameters) {
+        // The parameters keep their old values until timerCallback catches up; that isn't a change to apply
+        m_seenTuningIndex = m_tuningParam->getIndex();
+        m_seenVelocityPower = m_velocityPowerParam->get();
+    }
+    else {
+        // The parameters were set along with the program, so they win over the preset's values
+        m_seenTuningIndex = -1;
+        m_seenVelocityPower = -1.0f;
+    }
+
+    m_currentProgram = index;
+    m_presetParametersPending = syncParameters;
+    return true;
+}
+
+void LumatoneInterpreterProcessor::applyParameters (int tuningIndex, float velocityPower)
+{
+    // Every tuning's table was built with the preset, so switching is just an index. Sounding voices keep the note
+    // they started with (see DeviceState::noteToNoteOut), so a change in the middle of a chord doesn't split it.
+    if (tuningIndex != m_seenTuningIndex) {
+        m_activeTuningIndex = tuningIndex;
+        m_seenTuningIndex = tuningIndex;
+    }
+
+    if (velocityPower != m_seenVelocityPower) {
+        PresetBank::buildVelocityCurve (velocityPower, m_automatedVelocityCurve);
+        m_velocityCurve = &m_automatedVelocityCurve;
+        m_seenVelocityPower = velocityPower;
+    }
+}
+
+LumatoneInterpreterProcessor::BlockControls LumatoneInterpreterProcessor::getBlockControls() const
+{
+    return {
+        m_currentProgram.load(),
+        m_tuningParam->getIndex(),
+        m_velocityPowerParam->get(),
+        m_outputMode.load(),
+        m_adaptiveTuning.load(),
+        m_attackWindowMs.load(),
+        m_attackMaxSamples.load()};
+}
+
+void LumatoneInterpreterProcessor::journalControls (
+    const BlockControls& controls,
+    bool programSelected,
+    bool keepsParameters)
+{
+    using Control = InputJournal::Control;
+    auto& journalled = m_journalledControls;
+
+    // A program request is journalled even if it selects the program already in use, since it still resets the
+    // tuning and velocity curve to the preset's. The flag isn't part of what is remembered: a later change made by a
+    // MIDI Program Change gets journalled as a plain switch.
+    if (controls.program != journalled.program || programSelected) {
+        auto value = controls.program | (programSelected && keepsParameters ? InputJournal::programKeepsParameters : 0);
+        if (m_inputJournal.recordControl (Control::program, value))
+            journalled.program = controls.program;
+    }
+
+    auto journal = [this] (Control control, auto value, auto& journalledValue, juce::int32 encoded) {
+        if (value != journalledValue && m_inputJournal.recordControl (control, encoded))
+            journalledValue = value;
+    };
+    journal (Control::tuning, controls.tuningIndex, journalled.tuningIndex, controls.tuningIndex);
+    journal (
+        Control::velocityPower,
+        controls.velocityPower,
+        journalled.velocityPower,
+        std::bit_cast<juce::int32> (controls.velocityPower));
+    journal (Control::outputMode, controls.outputMode, journalled.outputMode, controls.outputMode);
+    journal (Control::adaptiveTuning, controls.adaptiveTuning, journalled.adaptiveTuning, controls.adaptiveTuning);
+    journal (
+        Control::attackWindowMs,
+        controls.attackWindowMs,
+        journalled.attackWindowMs,
+        std::bit_cast<juce::int32> (controls.attackWindowMs));
+    journal (
+        Control::attackMaxSamples,
+        controls.attackMaxSamples,
+        journalled.attackMaxSamples,
+        controls.attackMaxSamples);
+}
+
+void LumatoneInterpreterProcessor::applyJournalControl (InputJournal::Control control, juce::int32 value)
+{
+    // Called between blocks on the replay's thread, so a program goes straight to selectPreset, as it would at the
+    // start of the block; the rest set what the next block reads
+    switch (control) {
+    case InputJournal::Control::program: {
+        auto keepsParameters = (value & InputJournal::programKeepsParameters) != 0;
+        selectPreset (value & ~InputJournal::programKeepsParameters, ! keepsParameters);
+        break;
+    }
+    case InputJournal::Control::tuning:
+        *m_tuningParam = value;
+        break;
+    case InputJournal::Control::velocityPower:
+        *m_velocityPowerParam = std::bit_cast<float> (value);
+        break;
+    case InputJournal::Control::outputMode:
+        m_outputMode = value;
+        break;
+    case InputJournal::Control::adaptiveTuning:
+        m_adaptiveTuning = value != 0;
+        break;
+    case InputJournal::Control::attackWindowMs:
+        m_attackWindowMs = std::bit_cast<float> (value);
+        break;
+    case InputJournal::Control::attackMaxSamples:
+        m_attackMaxSamples = value;
+        break;
+    case InputJournal::Control::numControls:
+        break;
+    }
+}
+
+float LumatoneInterpreterProcessor::applyVelocityCurve (float velocity) const
+{
+    // Velocities can be fractional (fixups, attack estimates), so interpolate between the table's entries
+    auto clamped = std::clamp (velocity, 0.0f, 127.0f);
+    auto index = std::min ((int) clamped, 126);
+    auto fraction = clamped - (float) index;
+    const auto& curve = *m_velocityCurve;
+    auto below = curve[(size_t) index], above = curve[(size_t) index + 1];
+    return below + fraction * (above - below);
+}
+
+void LumatoneInterpreterProcessor::startVoice (
+    int device,
+    int channelIn,
+    int noteIn,
+    float velocity,
+    int initialPressure,
+    int samplePosition)
+{
+    // Track the most recent key
+    m_mostRecentKey = {channelIn, noteIn};
+    m_mostRecentDevice = device;
+
+    velocity = velocityFixup (device, channelIn, noteIn, velocity);
+
+    // Apply global velocity power curve
+    velocity = applyVelocityCurve (velocity);
+
+    // Clamp and convert to int for MIDI output
+    auto velocityOut = (juce::uint8) std::clamp ((int) std::round (velocity), 1, 127);
+
+    if (m_activeOutputMode == OutputMode::mts) {
+        auto slot = allocateMtsSlot (device, channelIn, noteIn, samplePosition);
+        m_midiOut.addEvent (juce::MidiMessage::noteOn (mtsChannel, slot, velocityOut), samplePosition);
+        m_midiOut.addEvent (
+            juce::MidiMessage::aftertouchChange (mtsChannel, slot, initialPressure), samplePosition);
+
+        // The key lights go to the first Lumatone only
+        if (device == 0)
+            m_ledFeedback.voiceStarted (channelIn, noteIn, 2 + slot % 15, false);
+        return;
+    }
+
+    auto [noteOut, bendOut] = lumaNoteToMidiNote (device, channelIn, noteIn);
+    auto chOut = allocateChannel (device, channelIn, noteIn);
+    m_devices[(size_t) device].noteToNoteOut[(size_t) (channelIn - 1)][(size_t) noteIn] = noteOut;
+    m_channelLastUsed[chOut] = m_blockStartSample + samplePosition;
+
+    m_channelPitches[chOut] = noteOut + bendOut;
+    m_channelBends[chOut] = bendOut;
+    m_sentPitchWheels[chOut] = bendToPitchWheel (bendOut);
+    if (m_adaptiveActive)
+        m_adaptiveTuner.voiceStarted (chOut, m_channelPitches[chOut]);
+
+    m_midiOut.addEvent (juce::MidiMessage::pitchWheel (chOut, m_sentPitchWheels[chOut]), samplePosition);
+    m_midiOut.addEvent (juce::MidiMessage::channelPressureChange (chOut, initialPressure), samplePosition);
+    primeControllers (chOut, samplePosition);
+    m_midiOut.addEvent (juce::MidiMessage::noteOn (chOut, noteOut, velocityOut), samplePosition);
+
+    // A voice that has to share a channel turns every key on it red, the ones it took the channel over from too
+    if (m_notesPerChannel[chOut] > 1)
+        updateChannelLeds (chOut);
+    else if (device == 0)
+        m_ledFeedback.voiceStarted (channelIn, noteIn, chOut, false);
+}
+
+void LumatoneInterpreterProcessor::stopVoice (int device, int channelIn, int noteIn, int samplePosition)
+{
+    if (findChannel (device, channelIn, noteIn) == noChannel)
+        return;
 
-            // Track the most recent key
-            m_mostRecentKey = {channelIn, noteIn};
+    auto& state = m_devices[(size_t) device];
+    if (device == 0)
+        m_ledFeedback.voiceStopped (channelIn, noteIn);
+
+    if (m_activeOutputMode == OutputMode::mts) {
+        auto slot = state.noteToSlot[(size_t) (channelIn - 1)][(size_t) noteIn];
+        state.noteToSlot[(size_t) (channelIn - 1)][(size_t) noteIn] = -1;
+        state.noteToChannel[(size_t) (channelIn - 1)][(size_t) noteIn] = noChannel;
+        m_activeVoices--;
+
+        // Keys with the same pitch share a slot, so it only stops when the last of them is released
+        if (--m_mtsSlotVoices[slot] == 0)
+            m_midiOut.addEvent (juce::MidiMessage::noteOff (mtsChannel, slot), samplePosition);
+        return;
+    }
 
-            auto [noteOut, bendOut] = lumaNoteToMidiNote (channelIn, noteIn);
-            auto chOut = allocateChannel (channelIn, noteIn);
-            velocity = velocityFixup (channelIn, noteIn, velocity);
+    auto noteOut = state.noteToNoteOut[(size_t) (channelIn - 1)][(size_t) noteIn];
+    auto chOut = deallocateChannel (device, channelIn, noteIn);
+    m_midiOut.addEvent (juce::MidiMessage::noteOff (chOut, noteOut), samplePosition);
+    m_channelLastUsed[chOut] = m_blockStartSample + samplePosition;
+
+    // The voice left behind has the channel to itself again
+    if (m_notesPerChannel[chOut] == 1)
+        updateChannelLeds (chOut);
+
+    if (m_adaptiveActive && m_notesPerChannel[chOut] == 0)
+        m_adaptiveTuner.voiceStopped (chOut);
+}
+
+void LumatoneInterpreterProcessor::updateChannelLeds (int chOut)
+{
+    if (! m_ledFeedback.isEnabled())
+        return;
+
+    // Only the first Lumatone is lit, but the others' voices still count towards sharing the channel
+    const auto& noteToChannel = m_devices[0].noteToChannel;
+    auto shared = m_notesPerChannel[chOut] > 1;
+    for (int ch = 2; ch < 2 + LedFeedback::numBoards; ++ch) {
+        for (int note = 0; note < LedFeedback::keysPerBoard; ++note) {
+            if (noteToChannel[(size_t) (ch - 1)][(size_t) note] == chOut)
+                m_ledFeedback.voiceStarted (ch, note, chOut, shared);
+        }
+    }
+}
 
-            // Apply global velocity power curve
-            velocity = std::pow (velocity / 127.0f, m_globalVelocityPower) * 127.0f;
+void LumatoneInterpreterProcessor::sendPressure (
+    int device,
+    int channelIn,
+    int noteIn,
+    int pressure,
+    int samplePosition)
+{
+    auto chOut = findChannel (device, channelIn, noteIn);
+    if (chOut == noChannel)
+        return;
 
-            // Clamp and convert to int for MIDI output
-            auto velocityOut = (juce::uint8) std::clamp ((int) std::round (velocity), 1, 127);
+    if (m_activeOutputMode == OutputMode::mts) {
+        auto slot = m_devices[(size_t) device].noteToSlot[(size_t) (channelIn - 1)][(size_t) noteIn];
+        m_midiOut.addEvent (juce::MidiMessage::aftertouchChange (mtsChannel, slot, pressure), samplePosition);
+    }
+    else {
+        m_midiOut.addEvent (juce::MidiMessage::channelPressureChange (chOut, pressure), samplePosition);
+    }
+}
 
-            midiOut.addEvent (
-                juce::MidiMessage::pitchWheel (
-                    chOut, std::clamp ((int) std::round (16383.0f * ((bendOut / 48.0f) / 2.0f + 0.5f)), 0, 16383)),
-                event.samplePosition);
-            midiOut.addEvent (juce::MidiMessage::channelPressureChange (chOut, initialPressure), event.samplePosition);
-            midiOut.addEvent (juce::MidiMessage::noteOn (chOut, noteOut, velocityOut), event.samplePosition);
+void LumatoneInterpreterProcessor::releaseAllVoices (int samplePosition)
+{
+    for (int device = 0; device < maxDevices; ++device) {
+        for (int ch = 1; ch <= 16; ++ch) {
+            for (int note = 0; note < 128; ++note)
+                stopVoice (device, ch, note, samplePosition);
         }
-        else if (message.isNoteOff()) {
-            int noteIn = message.getNoteNumber();
-            int channelIn = message.getChannel();
+    }
+}
+
+void LumatoneInterpreterProcessor::fanOutController (int controller, int value, int samplePosition)
+{
+    auto found = std::find (fanOutControllers.begin(), fanOutControllers.end(), controller);
+    if (found == fanOutControllers.end())
+        return;
+
+    auto index = (size_t) (found - fanOutControllers.begin());
+    m_controllerValues[index] = value;
 
-            auto [noteOut, bendOut] = lumaNoteToMidiNote (channelIn, noteIn);
-            auto chOut = deallocateChannel (channelIn, noteIn);
+    // In MTS mode the voices are on channel 1 already
+    if (m_activeOutputMode != OutputMode::channelPerVoice)
+        return;
 
-            if (chOut != -1) {
-                midiOut.addEvent (juce::MidiMessage::noteOff (chOut, noteOut), event.samplePosition);
+    auto time = m_blockStartSample + samplePosition;
+    auto holdSamples = (juce::int64) (controllerFanOutHoldMs * m_sampleRate / 1000.0);
+    for (int ch = 2; ch <= 16; ++ch) {
+        auto& sent = m_sentControllers[(size_t) ch];
+        if (sent[index] == value)
+            continue;
+
+        auto recent = m_channelLastUsed[(size_t) ch] >= 0 && time - m_channelLastUsed[(size_t) ch] < holdSamples;
+        auto sustained = sent[sustainFanOutIndex] >= 64;
+        if (m_notesPerChannel[(size_t) ch] > 0 || recent || sustained) {
+            m_midiOut.addEvent (juce::MidiMessage::controllerEvent (ch, controller, value), samplePosition);
+            sent[index] = value;
+        }
+    }
+}
+
+void LumatoneInterpreterProcessor::primeControllers (int channel, int samplePosition)
+{
+    auto& sent = m_sentControllers[(size_t) channel];
+    for (size_t i = 0; i < fanOutControllers.size(); ++i) {
+        if (m_controllerValues[i] >= 0 && sent[i] != m_controllerValues[i]) {
+            m_midiOut.addEvent (
+                juce::MidiMessage::controllerEvent (channel, fanOutControllers[i], m_controllerValues[i]),
+                samplePosition);
+            sent[i] = m_controllerValues[i];
+        }
+    }
+}
+
+void LumatoneInterpreterProcessor::updateAdaptiveTuning (bool enabled, int samplePosition)
+{
+    if (enabled != m_adaptiveActive) {
+        m_adaptiveActive = enabled;
+        m_adaptiveTuner.reset();
+        if (enabled) {
+            for (int ch = 2; ch <= 16; ++ch) {
+                if (m_notesPerChannel[ch] > 0)
+                    m_adaptiveTuner.voiceStarted (ch, m_channelPitches[ch]);
             }
         }
-        else if (message.isAftertouch()) {
-            // To channel pressure
-            int channelIn = message.getChannel();
-            int noteIn = message.getNoteNumber();
-            int pressure = message.getAfterTouchValue();
-
-            if (auto found = m_noteToChannel.find ({channelIn, noteIn}); found != m_noteToChannel.end()) {
-                auto chOut = found->second;
-                midiOut.addEvent (juce::MidiMessage::channelPressureChange (chOut, pressure), event.samplePosition);
+    }
+
+    if (m_adaptiveActive)
+        m_adaptiveTuner.solve (adaptiveSweepsPerBlock);
+
+    // With adaptive tuning off every offset is zero, which also puts voices back where they were
+    for (int ch = 2; ch <= 16; ++ch) {
+        if (m_notesPerChannel[ch] == 0)
+            continue;
+
+        auto wheel = bendToPitchWheel (
+            m_channelBends[ch] + (float) (m_adaptiveTuner.getOffsetCents (ch) / 100.0));
+        if (wheel != m_sentPitchWheels[ch]) {
+            m_midiOut.addEvent (juce::MidiMessage::pitchWheel (ch, wheel), samplePosition);
+            m_sentPitchWheels[ch] = wheel;
+        }
+    }
+}
+
+int LumatoneInterpreterProcessor::bendToPitchWheel (float semitones)
+{
+    // Assumes the synth's bend range is +/-48 semitones
+    return std::clamp ((int) std::round (16383.0f * ((semitones / 48.0f) / 2.0f + 0.5f)), 0, 16383);
+}
+
+void LumatoneInterpreterProcessor::updateMtsTuning()
+{
+    // The other devices' keys get single note changes wherever their pitches aren't in the first one's dump
+    const auto& table = getActiveTable (0);
+    if (m_mtsTableSent == &table)
+        return;
+
+    // A bulk dump would retune the held voices too. Until they are released, new voices are tuned by single note
+    // changes on top of the last dump (see allocateMtsSlot), and the dump waits.
+    if (m_mtsTableSent != nullptr && m_activeVoices.load() > 0)
+        return;
+
+    const auto& dump = table.getBulkDump();
+    m_midiOut.addEvent (dump.data(), (int) dump.size(), 0);
+
+    for (int slot = 0; slot < TuningTable::numSlots; ++slot)
+        m_mtsSlotPitches[(size_t) slot] = table.getSlotPitch (slot);
+    m_mtsTableSent = &table;
+}
+
+int LumatoneInterpreterProcessor::allocateMtsSlot (int device, int ch, int note, int samplePosition)
+{
+    auto noteId = m_nextNoteId++;
+    auto& state = m_devices[(size_t) device];
+
+    // Retriggering a held key keeps its slot
+    if (auto held = state.noteToSlot[(size_t) (ch - 1)][(size_t) note]; held != -1)
+        return held;
+
+    const auto& table = getActiveTable (device);
+    auto pitch = table.getPitch (ch, note);
+    auto slot = table.getSlot (ch, note);
+
+    // The key's own slot is usable unless another voice has retuned it and is still sounding there
+    if (slot == -1 || (m_mtsSlotVoices[(size_t) slot] > 0 && m_mtsSlotPitches[(size_t) slot] != pitch)) {
+        // Otherwise borrow the least recently used silent slot, and failing that the least recently used one
+        int silentSlot = -1, anySlot = -1;
+        int silentLruId = INT_MAX, anyLruId = INT_MAX;
+        for (int i = 0; i < TuningTable::numSlots; ++i) {
+            auto lruId = m_mtsSlotLru[(size_t) i];
+            if (m_mtsSlotVoices[(size_t) i] == 0 && lruId < silentLruId) {
+                silentLruId = lruId;
+                silentSlot = i;
+            }
+            if (lruId < anyLruId) {
+                anyLruId = lruId;
+                anySlot = i;
             }
         }
+        slot = silentSlot != -1 ? silentSlot : anySlot;
     }
 
-    midiMessages.swapWith (midiOut);
+    if (m_mtsSlotPitches[(size_t) slot] != pitch) {
+        auto change = TuningTable::singleNoteChange (slot, pitch);
+        m_midiOut.addEvent (change.data(), (int) change.size(), samplePosition);
+        m_mtsSlotPitches[(size_t) slot] = pitch;
+    }
+
+    state.noteToSlot[(size_t) (ch - 1)][(size_t) note] = slot;
+    state.noteToChannel[(size_t) (ch - 1)][(size_t) note] = mtsChannel;
+    m_mtsSlotVoices[(size_t) slot]++;
+    m_mtsSlotLru[(size_t) slot] = noteId;
+    m_activeVoices++;
+    return slot;
+}
+
+PressureVelocityEstimator* LumatoneInterpreterProcessor::findPendingAttack (int device, int ch, int note)
+{
+    for (auto& attack : m_devices[(size_t) device].pendingAttacks) {
+        if (attack.matches (ch, note))
+            return &attack;
+    }
+    return nullptr;
+}
+
+bool LumatoneInterpreterProcessor::beginAttack (int device, int ch, int note, int pressure, juce::int64 time)
+{
+    auto maxSamples = m_activeAttackMaxSamples;
+    auto windowSamples = (juce::int64) std::round (m_activeAttackWindowMs * m_sampleRate / 1000.0);
+    if (maxSamples <= 1 || windowSamples <= 0)
+        return false;
+
+    for (auto& attack : m_devices[(size_t) device].pendingAttacks) {
+        if (! attack.isActive()) {
+            attack.start (ch, note, time, pressure, time + windowSamples);
+            return true;
+        }
+    }
+    return false;
+}
+
+void LumatoneInterpreterProcessor::emitAttack (int device, PressureVelocityEstimator& attack, juce::int64 time)
+{
+    auto velocity = attack.estimateVelocity (m_sampleRate / 1000.0, attackVelocityPerSlope);
+    m_lastAttackLatencyMs = (float) ((double) (time - attack.getFirstSampleTime()) * 1000.0 / m_sampleRate);
+
+    auto samplePosition = (int) std::max ((juce::int64) 0, time - m_blockStartSample);
+    startVoice (device, attack.getChannel(), attack.getNote(), velocity, attack.getLastPressure(), samplePosition);
+    attack.clear();
+}
+
+void LumatoneInterpreterProcessor::emitDueAttacks (int device, juce::int64 time)
+{
+    for (auto& attack : m_devices[(size_t) device].pendingAttacks) {
+        if (attack.isActive() && attack.getDeadline() <= time)
+            emitAttack (device, attack, attack.getDeadline());
+    }
 }
 
-int LumatoneInterpreterProcessor::allocateChannel (int ch, int note)
+int LumatoneInterpreterProcessor::allocateChannel (int device, int ch, int note)
 {
     auto noteId = m_nextNoteId++;
     // Use the same channel for exactly the same note (lumatone-wise)
-    if (auto found = m_noteToChannel.find ({ch, note}); found != m_noteToChannel.end()) {
-        return found->second;
+    if (auto found = findChannel (device, ch, note); found != noChannel) {
+        return found;
     }
 
     // Look for the least recently used free channel
@@ -143,198 +769,57 @@ int LumatoneInterpreterProcessor::allocateChannel (int ch, int note)
             }
         }
     }
-    if (channel != -1) {
-        m_noteToChannel[{ch, note}] = channel;
-        m_notesPerChannel[channel]++;
-        m_channelLru[channel] = noteId;
-        return channel;
-    }
-
-    // Otherwise, use the least recently used channel with the fewest notes
-    int minNotes = INT_MAX;
-    for (int i = 2; i <= 16; ++i) {
-        if (m_notesPerChannel[i] < minNotes || (m_notesPerChannel[i] == minNotes && m_channelLru[i] < lruId)) {
-            minNotes = m_notesPerChannel[i];
-            lruId = m_channelLru[i];
-            channel = i;
+    if (channel == -1) {
+        // Otherwise, use the least recently used channel with the fewest notes
+        int minNotes = INT_MAX;
+        for (int i = 2; i <= 16; ++i) {
+            if (m_notesPerChannel[i] < minNotes || (m_notesPerChannel[i] == minNotes && m_channelLru[i] < lruId)) {
+                minNotes = m_notesPerChannel[i];
+                lruId = m_channelLru[i];
+                channel = i;
+            }
         }
     }
 
     jassert (channel != -1);
-    m_noteToChannel[{ch, note}] = channel;
+    m_devices[(size_t) device].noteToChannel[(size_t) (ch - 1)][(size_t) note] = channel;
     m_notesPerChannel[channel]++;
     m_channelLru[channel] = noteId;
+    m_activeVoices++;
     return channel;
 }
 
-int LumatoneInterpreterProcessor::deallocateChannel (int ch, int note)
+int LumatoneInterpreterProcessor::deallocateChannel (int device, int ch, int note)
 {
-    if (auto found = m_noteToChannel.find ({ch, note}); found != m_noteToChannel.end()) {
-        auto channel = found->second;
+    if (auto channel = findChannel (device, ch, note); channel != noChannel) {
         m_notesPerChannel[channel]--;
-        m_noteToChannel.erase (found);
+        m_devices[(size_t) device].noteToChannel[(size_t) (ch - 1)][(size_t) note] = noChannel;
+        m_activeVoices--;
         return channel;
     }
     return -1;
 }
 
-float LumatoneInterpreterProcessor::velocityFixup (int ch, int note, int vel) const
+float LumatoneInterpreterProcessor::velocityFixup (int device, int ch, int note, float vel) const
 {
-    // Check for user-defined fixups first
-    auto key = std::make_pair (ch, note);
-    if (auto found = m_velocityFixups.find (key); found != m_velocityFixups.end()) {
-        float pow = found->second;
-        float out = std::pow (vel / 127.0f, pow) * 127.0f;
-        return out;
-    }
+    // The instrument's calibration, then the preset's adjustment; both are power curves, so they multiply
+    auto pow = m_devices[(size_t) device].fixupPowers[(size_t) (ch - 1)][(size_t) note].load (std::memory_order_relaxed)
+             * m_activePreset->fixupPowers[(size_t) device][(size_t) (ch - 1)][(size_t) note];
+    if (pow != 1.0f)
+        return std::pow (vel / 127.0f, pow) * 127.0f;
 
-    return (float) vel;
+    return vel;
 }
 
-std::pair<int, float> LumatoneInterpreterProcessor::lumaNoteToMidiNote (int ch, int note) const
+std::pair<int, float> LumatoneInterpreterProcessor::lumaNoteToMidiNote (int device, int ch, int note) const
 {
-    int x, y;
-    std::tie (x, y) = lumaNoteToLocalCoord (note);
-
-    x += 5 * (ch - 2);
-    y += 2 * (ch - 2);
-
-    // And re-center so the middle is (10,9)
-    x -= 10;
-    y -= 9;
-
-    // Use the selected tuning system
-    const auto& tuning = getCurrentTuning();
-    double a = tuning.a;
-    double b = tuning.b;
-
-    double hz = 261.62 * std::pow (a, x) * std::pow (b, y);
-
-    double midiNote = 12.0 * std::log2 (hz / 440.0) + 69.0;
+    // Use the selected tuning system, laid out for this device
+    double midiNote = getActiveTable (device).getPitch (ch, note);
     int midiNoteOut = std::clamp ((int) std::round (midiNote), 0, 127);
     double bendOut = midiNote - midiNoteOut;
     return {midiNoteOut, (float) bendOut};
 }
 
-std::pair<int, int> LumatoneInterpreterProcessor::lumaNoteToLocalCoord (int note) const
-{
-    switch (note) {
-    case 0:
-        return {0, 0};
-    case 1:
-        return {1, 0};
-    case 2:
-        return {0, 1};
-    case 3:
-        return {1, 1};
-    case 4:
-        return {2, 1};
-    case 5:
-        return {3, 1};
-    case 6:
-        return {4, 1};
-    case 7:
-        return {-1, 2};
-    case 8:
-        return {0, 2};
-    case 9:
-        return {1, 2};
-    case 10:
-        return {2, 2};
-    case 11:
-        return {3, 2};
-    case 12:
-        return {4, 2};
-    case 13:
-        return {-1, 3};
-    case 14:
-        return {0, 3};
-    case 15:
-        return {1, 3};
-    case 16:
-        return {2, 3};
-    case 17:
-        return {3, 3};
-    case 18:
-        return {4, 3};
-    case 19:
-        return {-2, 4};
-    case 20:
-        return {-1, 4};
-    case 21:
-        return {0, 4};
-    case 22:
-        return {1, 4};
-    case 23:
-        return {2, 4};
-    case 24:
-        return {3, 4};
-    case 25:
-        return {-2, 5};
-    case 26:
-        return {-1, 5};
-    case 27:
-        return {0, 5};
-    case 28:
-        return {1, 5};
-    case 29:
-        return {2, 5};
-    case 30:
-        return {3, 5};
-    case 31:
-        return {-3, 6};
-    case 32:
-        return {-2, 6};
-    case 33:
-        return {-1, 6};
-    case 34:
-        return {0, 6};
-    case 35:
-        return {1, 6};
-    case 36:
-        return {2, 6};
-    case 37:
-        return {-3, 7};
-    case 38:
-        return {-2, 7};
-    case 39:
-        return {-1, 7};
-    case 40:
-        return {0, 7};
-    case 41:
-        return {1, 7};
-    case 42:
-        return {2, 7};
-    case 43:
-        return {-4, 8};
-    case 44:
-        return {-3, 8};
-    case 45:
-        return {-2, 8};
-    case 46:
-        return {-1, 8};
-    case 47:
-        return {0, 8};
-    case 48:
-        return {1, 8};
-    case 49:
-        return {-3, 9};
-    case 50:
-        return {-2, 9};
-    case 51:
-        return {-1, 9};
-    case 52:
-        return {0, 9};
-    case 53:
-        return {1, 9};
-    case 54:
-        return {-1, 10};
-    case 55:
-        return {0, 10};
-    }
-    return {0, 0};
-}
-
 bool LumatoneInterpreterProcessor::hasEditor() const
 {
     return true;
@@ -364,26 +849,61 @@ double LumatoneInterpreterProcessor::getTailLengthSeconds() const
 
 int LumatoneInterpreterProcessor::getNumPrograms()
 {
-    return 0;
+    return m_presetBank.getNumPresets();
 }
 
 int LumatoneInterpreterProcessor::getCurrentProgram()
 {
-    return 0;
+    // A request the audio thread hasn't taken yet is already the current program as far as the host and the editor
+    // are concerned; without audio running it would otherwise never show
+    if (auto request = m_requestedProgram.load(); request != noProgramRequest) {
+        if (auto index = request >> 1; index < m_presetBank.getNumPresets())
+            return index;
+    }
+    return m_currentProgram.load();
 }
 
-void LumatoneInterpreterProcessor::setCurrentProgram (int) {}
+void LumatoneInterpreterProcessor::setCurrentProgram (int index)
+{
+    requestProgram (index, false);
+}
 
-const juce::String LumatoneInterpreterProcessor::getProgramName (int)
+const juce::String LumatoneInterpreterProcessor::getProgramName (int index)
 {
-    return "None";
+    if (index >= 0 && index < m_presetBank.getNumPresets())
+        return m_presetBank.getPreset (index).name;
+    return {};
 }
 
 void LumatoneInterpreterProcessor::changeProgramName (int, const juce::String&) {}
 
-void LumatoneInterpreterProcessor::getStateInformation (juce::MemoryBlock&) {}
+void LumatoneInterpreterProcessor::getStateInformation (juce::MemoryBlock& destData)
+{
+    // What the host saves with its project: the automatable parameters and the program. The calibration and the
+    // other settings belong to the instrument rather than the project, and stay in velocity_fixups.xml.
+    juce::XmlElement state ("LumatoneInterpreterState");
+    state.setAttribute ("program", getCurrentProgram());
+    state.setAttribute ("velocityPower", (double) getGlobalVelocityPower());
+    state.setAttribute ("tuning", getCurrentTuning().name);
+    copyXmlToBinary (state, destData);
+}
 
-void LumatoneInterpreterProcessor::setStateInformation (const void*, int) {}
+void LumatoneInterpreterProcessor::setStateInformation (const void* data, int sizeInBytes)
+{
+    auto state = getXmlFromBinary (data, sizeInBytes);
+    if (state == nullptr || ! state->hasTagName ("LumatoneInterpreterState"))
+        return;
+
+    // Tunings are stored by name, like in the preset bank
+    auto tuningName = state->getStringAttribute ("tuning");
+    for (size_t i = 0; i < m_availableTunings.size(); ++i) {
+        if (m_availableTunings[i].name == tuningName)
+            *m_tuningParam = (int) i;
+    }
+    *m_velocityPowerParam = (float) state->getDoubleAttribute ("velocityPower", getGlobalVelocityPower());
+
+    requestProgram (state->getIntAttribute ("program", getCurrentProgram()), true);
+}
 
 juce::AudioProcessor::BusesProperties LumatoneInterpreterProcessor::getBusesProperties()
 {
@@ -395,66 +915,129 @@ juce::AudioProcessor* createPluginFilter()
     return std::make_unique<LumatoneInterpreterProcessor>().release();
 }
 
-float LumatoneInterpreterProcessor::getVelocityFixup (int ch, int note) const
+float LumatoneInterpreterProcessor::getVelocityFixup (int device, int ch, int note) const
 {
+    const auto& fixups = m_devices[(size_t) device].velocityFixups;
     auto key = std::make_pair (ch, note);
-    if (auto found = m_velocityFixups.find (key); found != m_velocityFixups.end()) {
+    if (auto found = fixups.find (key); found != fixups.end()) {
         return found->second;
     }
     return 1.0f; // Default value
 }
 
-void LumatoneInterpreterProcessor::setVelocityFixup (int ch, int note, float powerValue)
+void LumatoneInterpreterProcessor::setVelocityFixup (int device, int ch, int note, float powerValue)
 {
+    auto& state = m_devices[(size_t) device];
     auto key = std::make_pair (ch, note);
     if (powerValue == 1.0f) {
         // Remove the fixup if it's the default value
-        m_velocityFixups.erase (key);
+        state.velocityFixups.erase (key);
     }
     else {
-        m_velocityFixups[key] = powerValue;
+        state.velocityFixups[key] = powerValue;
     }
+    if (ch >= 1 && ch <= 16 && note >= 0 && note < 128)
+        state.fixupPowers[(size_t) (ch - 1)][(size_t) note] = powerValue;
     saveVelocityFixups();
 }
 
 void LumatoneInterpreterProcessor::setGlobalVelocityPower (float power)
 {
-    m_globalVelocityPower = power;
+    setParameterAsGesture (*m_velocityPowerParam, power);
+    saveVelocityFixups();
+}
+
+void LumatoneInterpreterProcessor::setAttackWindowMs (float ms)
+{
+    m_attackWindowMs = std::max (0.0f, ms);
+    saveVelocityFixups();
+}
+
+void LumatoneInterpreterProcessor::setAttackMaxSamples (int numSamples)
+{
+    m_attackMaxSamples = std::clamp (numSamples, 1, PressureVelocityEstimator::capacity);
+    saveVelocityFixups();
+}
+
+void LumatoneInterpreterProcessor::setLedFeedbackEnabled (bool enabled)
+{
+    m_ledFeedback.setEnabled (enabled);
+    saveVelocityFixups();
+}
+
+void LumatoneInterpreterProcessor::setOutputMode (OutputMode mode)
+{
+    m_outputMode = (int) mode;
+    saveVelocityFixups();
+}
+
+void LumatoneInterpreterProcessor::setAdaptiveTuning (bool enabled)
+{
+    m_adaptiveTuning = enabled;
     saveVelocityFixups();
 }
 
 void LumatoneInterpreterProcessor::setCurrentTuningIndex (int index)
 {
     if (index >= 0 && index < static_cast<int> (m_availableTunings.size())) {
-        m_currentTuningIndex = index;
+        setParameterAsGesture (*m_tuningParam, (float) index);
         saveVelocityFixups(); // We'll save tuning state along with other settings
     }
 }
 
-void LumatoneInterpreterProcessor::saveVelocityFixups()
+std::unique_ptr<juce::XmlElement> LumatoneInterpreterProcessor::createSettingsXml() const
 {
-    juce::XmlElement root ("VelocityFixups");
+    auto root = std::make_unique<juce::XmlElement> ("VelocityFixups");
 
     // Save global velocity power setting
-    root.setAttribute ("globalVelocityPower", (double) m_globalVelocityPower);
+    root->setAttribute ("globalVelocityPower", (double) getGlobalVelocityPower());
 
-    // Save current tuning index
-    root.setAttribute ("currentTuningIndex", m_currentTuningIndex);
+    // Save current tuning index and program
+    root->setAttribute ("currentTuningIndex", getCurrentTuningIndex());
+    root->setAttribute ("currentProgram", m_currentProgram.load());
 
-    for (const auto& [key, value] : m_velocityFixups) {
-        auto* fixupElement = root.createNewChildElement ("Fixup");
-        fixupElement->setAttribute ("channel", key.first);
-        fixupElement->setAttribute ("note", key.second);
-        fixupElement->setAttribute ("power", (double) value);
+    // Save CC-mode attack estimation settings
+    root->setAttribute ("attackWindowMs", (double) m_attackWindowMs.load());
+    root->setAttribute ("attackMaxSamples", m_attackMaxSamples.load());
+
+    root->setAttribute ("ledFeedback", m_ledFeedback.isEnabled());
+
+    root->setAttribute ("outputMode", getOutputMode() == OutputMode::mts ? "mts" : "channelPerVoice");
+    root->setAttribute ("adaptiveTuning", m_adaptiveTuning.load());
+    return root;
+}
+
+void LumatoneInterpreterProcessor::saveVelocityFixups()
+{
+    LUMATONE_TRACE_SCOPE ("saveVelocityFixups");
+
+    if (! m_settingsFileEnabled)
+        return;
+
+    auto root = createSettingsXml();
+    m_savedParameters = m_lastSeenParameters = getParametersToSave();
+
+    for (int device = 0; device < maxDevices; ++device) {
+        for (const auto& [key, value] : m_devices[(size_t) device].velocityFixups) {
+            auto* fixupElement = root->createNewChildElement ("Fixup");
+            // Files from before there were several devices only have the first one's
+            if (device != 0)
+                fixupElement->setAttribute ("device", device);
+            fixupElement->setAttribute ("channel", key.first);
+            fixupElement->setAttribute ("note", key.second);
+            fixupElement->setAttribute ("power", (double) value);
+        }
     }
 
-    if (! root.writeTo (m_velocityFixupFile)) {
+    if (! root->writeTo (m_velocityFixupFile)) {
         std::cout << "Failed to save velocity fixups to " << m_velocityFixupFile.getFullPathName() << std::endl;
     }
 }
 
 void LumatoneInterpreterProcessor::loadVelocityFixups()
 {
+    LUMATONE_TRACE_SCOPE ("loadVelocityFixups");
+
     if (! m_velocityFixupFile.exists())
         return;
 
@@ -464,25 +1047,100 @@ void LumatoneInterpreterProcessor::loadVelocityFixups()
         return;
     }
 
-    m_velocityFixups.clear();
+    applySettingsXml (*xml);
+}
+
+void LumatoneInterpreterProcessor::applySettingsXml (const juce::XmlElement& xml)
+{
+    for (auto& state : m_devices) {
+        state.velocityFixups.clear();
+        for (auto& powers : state.fixupPowers) {
+            for (auto& fixupPower : powers)
+                fixupPower = 1.0f;
+        }
+    }
 
     // Load global velocity power setting
-    m_globalVelocityPower = (float) xml->getDoubleAttribute ("globalVelocityPower", 1.0);
+    *m_velocityPowerParam = (float) xml.getDoubleAttribute ("globalVelocityPower", 1.0);
 
     // Load current tuning index
-    m_currentTuningIndex = xml->getIntAttribute ("currentTuningIndex", 0);
+    auto tuningIndex = xml.getIntAttribute ("currentTuningIndex", 0);
     // Ensure the loaded index is valid
-    if (m_currentTuningIndex < 0 || m_currentTuningIndex >= static_cast<int> (m_availableTunings.size())) {
-        m_currentTuningIndex = 0;
+    if (tuningIndex < 0 || tuningIndex >= static_cast<int> (m_availableTunings.size())) {
+        tuningIndex = 0;
     }
+    *m_tuningParam = tuningIndex;
+
+    // Checked against the preset bank once it is loaded
+    m_currentProgram = xml.getIntAttribute ("currentProgram", 0);
 
-    for (auto* fixupElement : xml->getChildIterator()) {
+    // Load CC-mode attack estimation settings
+    m_attackWindowMs = std::max (0.0f, (float) xml.getDoubleAttribute ("attackWindowMs", 2.0));
+    m_attackMaxSamples =
+        std::clamp (xml.getIntAttribute ("attackMaxSamples", 4), 1, PressureVelocityEstimator::capacity);
+
+    m_ledFeedback.setEnabled (xml.getBoolAttribute ("ledFeedback", false));
+
+    m_outputMode =
+        (int) (xml.getStringAttribute ("outputMode") == "mts" ? OutputMode::mts : OutputMode::channelPerVoice);
+    m_adaptiveTuning = xml.getBoolAttribute ("adaptiveTuning", false);
+
+    for (auto* fixupElement : xml.getChildIterator()) {
         if (fixupElement->hasTagName ("Fixup")) {
+            int device = fixupElement->getIntAttribute ("device", 0);
             int channel = fixupElement->getIntAttribute ("channel");
             int note = fixupElement->getIntAttribute ("note");
             float power = (float) fixupElement->getDoubleAttribute ("power");
+            if (device < 0 || device >= maxDevices)
+                continue;
+
+            auto& state = m_devices[(size_t) device];
+            state.velocityFixups[{channel, note}] = power;
+            if (channel >= 1 && channel <= 16 && note >= 0 && note < 128)
+                state.fixupPowers[(size_t) (channel - 1)][(size_t) note] = power;
+        }
+    }
+}
 
-            m_velocityFixups[{channel, note}] = power;
+juce::String LumatoneInterpreterProcessor::createJournalSnapshot() const
+{
+    // The settings file's contents and the preset bank. This may run on the audio device's thread, so the calibration
+    // comes from the tables processBlock reads rather than the message thread's maps.
+    auto settings = createSettingsXml();
+    for (int device = 0; device < maxDevices; ++device) {
+        for (int channel = 1; channel <= 16; ++channel) {
+            for (int note = 0; note < 128; ++note) {
+                auto power = m_devices[(size_t) device].fixupPowers[(size_t) (channel - 1)][(size_t) note].load();
+                if (power == 1.0f)
+                    continue;
+
+                auto* fixupElement = settings->createNewChildElement ("Fixup");
+                fixupElement->setAttribute ("device", device);
+                fixupElement->setAttribute ("channel", channel);
+                fixupElement->setAttribute ("note", note);
+                fixupElement->setAttribute ("power", (double) power);
+            }
         }
     }
+
+    juce::XmlElement snapshot ("JournalSnapshot");
+    snapshot.addChildElement (settings.release());
+    if (auto* bank = m_presetBank.getSource())
+        snapshot.addChildElement (new juce::XmlElement (*bank));
+
+    return snapshot.toString (juce::XmlElement::TextFormat().singleLine().withoutHeader());
+}
+
+void LumatoneInterpreterProcessor::restoreJournalSnapshot (const juce::XmlElement& snapshot)
+{
+    // Before prepareToPlay, like the constructor's loading: the bank is recompiled, so nothing may still point into it
+    if (auto* settings = snapshot.getChildByName ("VelocityFixups"))
+        applySettingsXml (*settings);
+
+    m_presetBank.loadFromXml (
+        snapshot.getChildByName ("Presets"), m_availableTunings, getCurrentTuningIndex(), getGlobalVelocityPower());
+    m_mtsTableSent = nullptr;
+
+    auto program = m_currentProgram.load();
+    selectPreset (program >= 0 && program < m_presetBank.getNumPresets() ? program : 0, false);
 }
@@ -1,7 +1,17 @@
 #pragma once
 
+#include "AdaptiveTuner.h"
+#include "DeviceInput.h"
+#include "InputJournal.h"
+#include "LedFeedback.h"
+#include "PresetBank.h"
+#include "PressureVelocityEstimator.h"
+#include "TuningTable.h"
+
 #include <juce_audio_processors/juce_audio_processors.h>
 
+#include <span>
+
 // hash for std::pair
 namespace std
 {
@@ -15,21 +25,10 @@ struct hash<std::pair<T, U>>
 // Forward declaration for the velocity fixup editor
 class VelocityFixupEditor;
 
-// Tuning system structure
-struct TuningSystem
-{
-    juce::String name;
-    double a; // Horizontal interval
-    double b; // Vertical interval
-    juce::String description;
-
-    TuningSystem (const juce::String& n, double aVal, double bVal, const juce::String& desc = "")
-    : name (n), a (aVal), b (bVal), description (desc)
-    {}
-};
-
 /** As the name suggest, this class does the actual audio processing. */
-class LumatoneInterpreterProcessor : public juce::AudioProcessor
+class LumatoneInterpreterProcessor
+: public juce::AudioProcessor
+, private juce::Timer
 {
 public:
     LumatoneInterpreterProcessor();
@@ -44,6 +43,19 @@ public:
     using AudioProcessor::processBlock;
     void processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages) override;
 
+    // Lumatones played at once. Device 0 is whatever the host sends processBlock; the others are read from the
+    // DeviceInput attached for them, which the Standalone app owns and connects any further Lumatones to. Each device
+    // has its own voice table, calibration and layout (see PresetBank), and they all share the output channels.
+    static constexpr int maxDevices = Preset::maxDevices;
+    void attachDeviceInput (int device, DeviceInput* input) { m_deviceInputs[(size_t) device] = input; }
+
+    // processBlock with the devices' input already separated: midiMessages holds device 0's events (and the output
+    // on return), otherDevices[i] device i + 1's. Journal replay calls this directly.
+    void processDevices (
+        juce::AudioBuffer<float>& audio,
+        juce::MidiBuffer& midiMessages,
+        std::span<const juce::MidiBuffer> otherDevices);
+
     bool hasEditor() const override;
     juce::AudioProcessorEditor* createEditor() override;
 
@@ -61,52 +73,270 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
-    int getActiveVoices() const { return m_noteToChannel.size(); }
+    int getActiveVoices() const { return m_activeVoices.load(); }
 
-    // Velocity fixup functionality
+    // Velocity fixup functionality. These calibrate each instrument, so they apply under every preset, on top of the
+    // preset's own fixups.
     std::pair<int, int> getMostRecentKey() const { return m_mostRecentKey; }
-    float getVelocityFixup (int ch, int note) const;
-    void setVelocityFixup (int ch, int note, float powerValue);
+    int getMostRecentDevice() const { return m_mostRecentDevice; }
+    float getVelocityFixup (int device, int ch, int note) const;
+    void setVelocityFixup (int device, int ch, int note, float powerValue);
     void saveVelocityFixups();
     void loadVelocityFixups();
 
-    // Global velocity sensitivity
-    float getGlobalVelocityPower() const { return m_globalVelocityPower; }
+    // Global velocity sensitivity. Host-automatable; like the tuning below, a change takes effect from the start of
+    // the next block processBlock sees, so every event in a block uses the same value. The editor attaches to the
+    // parameters themselves; the setters are for everything else and save the settings straight away.
+    float getGlobalVelocityPower() const { return m_velocityPowerParam->get(); }
     void setGlobalVelocityPower (float power);
+    juce::AudioParameterFloat& getVelocityPowerParameter() { return *m_velocityPowerParam; }
+
+    // CC-mode attack estimation. A pressure key's note-on is held back until either getAttackMaxSamples() pressure
+    // values have arrived or getAttackWindowMs() has passed since the first one, and its velocity is estimated from
+    // how fast the pressure rose. A window of 0 or a single sample sends the first value straight away.
+    float getAttackWindowMs() const { return m_attackWindowMs.load(); }
+    void setAttackWindowMs (float ms);
+    int getAttackMaxSamples() const { return m_attackMaxSamples.load(); }
+    void setAttackMaxSamples (int numSamples);
+    float getLastAttackLatencyMs() const { return m_lastAttackLatencyMs.load(); }
+
+    // Raw input recorder, for replaying what happened on stage. A replay restores the snapshot the journal starts
+    // with and applies its control changes before the blocks they belong to, with the settings file turned off so
+    // none of it is saved.
+    InputJournal& getInputJournal() { return m_inputJournal; }
+    juce::String createJournalSnapshot() const;
+    void restoreJournalSnapshot (const juce::XmlElement& snapshot);
+    void applyJournalControl (InputJournal::Control control, juce::int32 value);
+    void setSettingsFileEnabled (bool enabled) { m_settingsFileEnabled = enabled; }
+
+    // Key lighting on the Lumatone
+    LedFeedback& getLedFeedback() { return m_ledFeedback; }
+    void setLedFeedbackEnabled (bool enabled);
+
+    // Position of a key within its board, in the board's own hex coordinates
+    static std::pair<int, int> lumaNoteToLocalCoord (int note) { return ::lumaNoteToLocalCoord (note); }
 
     // Tuning system functionality
     const std::vector<TuningSystem>& getAvailableTunings() const { return m_availableTunings; }
-    int getCurrentTuningIndex() const { return m_currentTuningIndex; }
+    int getCurrentTuningIndex() const { return m_tuningParam->getIndex(); }
     void setCurrentTuningIndex (int index);
-    const TuningSystem& getCurrentTuning() const { return m_availableTunings[m_currentTuningIndex]; }
+    juce::AudioParameterChoice& getTuningParameter() { return *m_tuningParam; }
+    const TuningSystem& getCurrentTuning() const { return m_availableTunings[(size_t) getCurrentTuningIndex()]; }
+
+    // How pitches reach the synth
+    enum class OutputMode
+    {
+        // Every voice gets its own channel (2-16), with a pitch bend of +/-48 semitones for the microtonal part
+        channelPerVoice,
+        // Plain notes on channel 1, tuned by MIDI Tuning Standard SysEx. Needs an MTS-capable synth.
+        mts
+    };
+    OutputMode getOutputMode() const { return (OutputMode) m_outputMode.load(); }
+    void setOutputMode (OutputMode mode);
+
+    // Adaptive just intonation: in channel-per-voice mode, held voices are bent by a few cents toward just
+    // intervals with each other (see AdaptiveTuner)
+    bool getAdaptiveTuning() const { return m_adaptiveTuning.load(); }
+    void setAdaptiveTuning (bool enabled);
 
 private:
     static BusesProperties getBusesProperties();
 
-    std::pair<int, float> lumaNoteToMidiNote (int ch, int note) const;
-    std::pair<int, int> lumaNoteToLocalCoord (int note) const;
-    float velocityFixup (int ch, int note, int vel) const;
+    // The settings file's root element, without the calibration, and the reverse (calibration included)
+    std::unique_ptr<juce::XmlElement> createSettingsXml() const;
+    void applySettingsXml (const juce::XmlElement& xml);
+
+    std::pair<int, float> lumaNoteToMidiNote (int device, int ch, int note) const;
+    float velocityFixup (int device, int ch, int note, float vel) const;
 
+    // Everything that belongs to one Lumatone. Input keys are indexed by [channel - 1][note].
+    struct DeviceState
+    {
+        std::array<std::array<int, 128>, 16> noteToChannel;
+        std::array<std::array<int, 128>, 16> noteToNoteOut {}; // what the note-off must match, whatever the tuning now
+        std::array<std::array<int, 128>, 16> noteToSlot;
+        std::array<PressureVelocityEstimator, 32> pendingAttacks;
+
+        // Calibration. The map is the message thread's copy, which gets saved; processBlock reads fixupPowers.
+        std::unordered_map<std::pair<int, int>, float> velocityFixups;
+        std::array<std::array<std::atomic<float>, 128>, 16> fixupPowers;
+    };
+    std::array<DeviceState, maxDevices> m_devices;
+    std::array<std::atomic<DeviceInput*>, maxDevices> m_deviceInputs {}; // device 0's is not used
+    std::array<juce::MidiBuffer, maxDevices - 1> m_otherDeviceMidi;
+
+    // Voice allocation state, shared by all devices. Everything here is touched from processBlock, so it is
+    // fixed-size: output channels are indexed by their channel number.
+    static constexpr int noChannel = -1;
     int m_nextNoteId = 0;
-    std::unordered_map<int, int> m_channelLru;
-    std::unordered_map<std::pair<int, int>, int> m_noteToChannel;
-    std::unordered_map<int, int> m_notesPerChannel;
+    std::array<int, 17> m_channelLru {};
+    std::array<int, 17> m_notesPerChannel {};
+    std::atomic<int> m_activeVoices {0};
+
+    // Channel 1 controllers that also go to the voice channels in channel-per-voice mode: mod wheel, expression and
+    // sustain. m_controllerValues is the latest value of each (-1 before the first); m_sentControllers is what each
+    // output channel was last sent, so unchanged values aren't repeated. A controller goes to channels with voices,
+    // channels whose last voice ended less than controllerFanOutHoldMs ago (release tails) and channels still held by
+    // the sustain pedal; the rest are brought up to date when they are next allocated.
+    static constexpr std::array<int, 3> fanOutControllers {1, 11, 64};
+    static constexpr size_t sustainFanOutIndex = 2;
+    static constexpr double controllerFanOutHoldMs = 2000.0;
+    std::array<int, fanOutControllers.size()> m_controllerValues;
+    std::array<std::array<int, fanOutControllers.size()>, 17> m_sentControllers;
+    std::array<juce::int64, 17> m_channelLastUsed; // sample time of the last note on or off, -1 if never
+
+    // Output is built here rather than in a local buffer so that it doesn't allocate once it has grown
+    juce::MidiBuffer m_midiOut;
 
-    // Velocity fixup data
-    std::unordered_map<std::pair<int, int>, float> m_velocityFixups;
+    // Velocity fixup data (the fixups themselves are in DeviceState)
     std::pair<int, int> m_mostRecentKey {0, 0};
+    int m_mostRecentDevice = 0;
     juce::File m_velocityFixupFile;
-    float m_globalVelocityPower = 1.0f;
+    bool m_settingsFileEnabled = true;
 
-    // Tuning system data
+    // Host-automatable parameters, owned by AudioProcessor. processBlock picks up changes at the start of a block
+    // (applyParameters) and keeps its own copies, so the values can't move between the events of one block.
+    // m_seenTuningIndex and m_seenVelocityPower are the parameter values it last acted on.
+    juce::AudioParameterFloat* m_velocityPowerParam = nullptr;
+    juce::AudioParameterChoice* m_tuningParam = nullptr;
+    int m_seenTuningIndex = -1;
+    float m_seenVelocityPower = -1.0f;
+    std::array<float, 128> m_automatedVelocityCurve {};
+
+    // The parameter values and program in the settings file, and those timerCallback saw on its last tick. However
+    // they move (editor, automation, program changes), the file is brought up to date once they settle.
+    struct SavedParameters
+    {
+        float velocityPower;
+        int tuningIndex;
+        int program;
+
+        bool operator== (const SavedParameters&) const = default;
+    };
+    SavedParameters getParametersToSave() const
+    {
+        return {getGlobalVelocityPower(), getCurrentTuningIndex(), m_currentProgram.load()};
+    }
+    SavedParameters m_savedParameters {};
+    SavedParameters m_lastSeenParameters {};
+
+    // Output velocity for each input velocity: the active preset's curve, or m_automatedVelocityCurve once the
+    // velocity parameter has moved
+    const std::array<float, 128>* m_velocityCurve = nullptr;
+
+    // Programs. Everything a preset needs was compiled when the bank was loaded, so selectPreset only swaps pointers.
+    // Program changes from the host or editor go through m_requestedProgram to the audio thread; timerCallback then
+    // brings the parameters in line with what the audio thread switched to. A restored host state asks for its
+    // program with the keep-parameters flag set instead, since it restores the parameters too. The request is the
+    // index and the flag packed together, (index << 1) | keepsParameters, so they are taken in one exchange.
+    static constexpr int noProgramRequest = -1;
+    PresetBank m_presetBank;
+    const Preset* m_activePreset = nullptr;
+    std::atomic<int> m_currentProgram {0};
+    std::atomic<int> m_requestedProgram {noProgramRequest};
+    std::atomic<bool> m_presetParametersPending {false};
+    void requestProgram (int index, bool keepsParameters)
+    {
+        if (index >= 0)
+            m_requestedProgram = index << 1 | (keepsParameters ? 1 : 0);
+    }
+
+    // CC-mode attack estimation. Times are in samples since the processor was created. Like the parameters, the
+    // settings are picked up at the start of a block (m_activeAttack*).
+    static constexpr float attackVelocityPerSlope = 5.0f; // velocity per (pressure unit / ms) of rise
+    double m_sampleRate = 44100.0;
+    juce::int64 m_blockStartSample = 0;
+    std::atomic<float> m_attackWindowMs {2.0f};
+    std::atomic<int> m_attackMaxSamples {4};
+    std::atomic<float> m_lastAttackLatencyMs {0.0f};
+    float m_activeAttackWindowMs = 2.0f;
+    int m_activeAttackMaxSamples = 4;
+
+    // Everything a block acts on besides its input, read once at its start. m_journalledControls is what the input
+    // journal was last told, so only changes are recorded.
+    struct BlockControls
+    {
+        int program;
+        int tuningIndex;
+        float velocityPower;
+        int outputMode;
+        bool adaptiveTuning;
+        float attackWindowMs;
+        int attackMaxSamples;
+    };
+    BlockControls getBlockControls() const;
+    void journalControls (const BlockControls& controls, bool programSelected, bool keepsParameters);
+    BlockControls m_journalledControls {};
+
+    LedFeedback m_ledFeedback;
+    InputJournal m_inputJournal;
+
+    // Tuning system data. The tables themselves belong to the presets, one for each of m_availableTunings.
     std::vector<TuningSystem> m_availableTunings;
-    int m_currentTuningIndex = 0;
+    int m_activeTuningIndex = 0;
+
+    // MTS output state. Slots are the note numbers on mtsChannel; m_mtsSlotPitches is what the synth was last told
+    // each slot's pitch is, which the single note tuning changes move away from m_mtsTableSent's.
+    static constexpr int mtsChannel = 1;
+    std::atomic<int> m_outputMode {(int) OutputMode::channelPerVoice};
+    OutputMode m_activeOutputMode = OutputMode::channelPerVoice;
+    const TuningTable* m_mtsTableSent = nullptr;
+    std::array<double, TuningTable::numSlots> m_mtsSlotPitches {};
+    std::array<int, TuningTable::numSlots> m_mtsSlotVoices {};
+    std::array<int, TuningTable::numSlots> m_mtsSlotLru {};
+
+    // Adaptive tuning state. m_channelPitches and m_channelBends are the tempered pitch of the newest voice on each
+    // output channel and its bend from the note number; m_sentPitchWheels is what was last sent.
+    static constexpr int adaptiveSweepsPerBlock = 4;
+    std::atomic<bool> m_adaptiveTuning {false};
+    bool m_adaptiveActive = false;
+    AdaptiveTuner m_adaptiveTuner;
+    std::array<double, 17> m_channelPitches {};
+    std::array<float, 17> m_channelBends {};
+    std::array<int, 17> m_sentPitchWheels {};
+
+    void timerCallback() override;
+    bool selectPreset (int index, bool syncParameters);
+    static void setParameterAsGesture (juce::RangedAudioParameter& parameter, float value);
+    void applyParameters (int tuningIndex, float velocityPower);
+    const TuningTable& getActiveTable (int device) const
+    {
+        return m_activePreset->tuningTables[(size_t) device][(size_t) m_activeTuningIndex];
+    }
+    float applyVelocityCurve (float velocity) const;
+
+    void processEvent (int device, const juce::MidiMessageMetadata& event);
+
+    void startVoice (int device, int channelIn, int noteIn, float velocity, int initialPressure, int samplePosition);
+    void stopVoice (int device, int channelIn, int noteIn, int samplePosition);
+    void sendPressure (int device, int channelIn, int noteIn, int pressure, int samplePosition);
+    void releaseAllVoices (int samplePosition);
+    void updateChannelLeds (int chOut);
+
+    void fanOutController (int controller, int value, int samplePosition);
+    void primeControllers (int channel, int samplePosition);
+
+    void updateAdaptiveTuning (bool enabled, int samplePosition);
+    static int bendToPitchWheel (float semitones);
+
+    void updateMtsTuning();
+    int allocateMtsSlot (int device, int ch, int note, int samplePosition);
+
+    PressureVelocityEstimator* findPendingAttack (int device, int ch, int note);
+    bool beginAttack (int device, int ch, int note, int pressure, juce::int64 time);
+    void emitAttack (int device, PressureVelocityEstimator& attack, juce::int64 time);
+    void emitDueAttacks (int device, juce::int64 time);
 
-    int allocateChannel (int ch, int note);
-    int deallocateChannel (int ch, int note);
+    int allocateChannel (int device, int ch, int note);
+    int deallocateChannel (int device, int ch, int note);
+    int findChannel (int device, int ch, int note) const
+    {
+        return m_devices[(size_t) device].noteToChannel[(size_t) (ch - 1)][(size_t) note];
+    }
 
     friend class LumatoneInterpreterEditor;
     friend class VelocityFixupEditor;
 
+    JUCE_DECLARE_WEAK_REFERENCEABLE (LumatoneInterpreterProcessor)
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LumatoneInterpreterProcessor)
 };
@@ -0,0 +1,130 @@
+#include "PresetBank.h"
+
+#include <cmath>
+
+namespace
+{
+KeyboardLayout readLayout (const juce::XmlElement& element, KeyboardLayout layout)
+{
+    layout.boardStepX = element.getIntAttribute ("boardStepX", layout.boardStepX);
+    layout.boardStepY = element.getIntAttribute ("boardStepY", layout.boardStepY);
+    layout.centreX = element.getIntAttribute ("centreX", layout.centreX);
+    layout.centreY = element.getIntAttribute ("centreY", layout.centreY);
+
+    // Pitches are worked out in log space from centreHz, so it has to be a real frequency
+    auto centreHz = element.getDoubleAttribute ("centreHz", layout.centreHz);
+    if (std::isfinite (centreHz) && centreHz > 0.0)
+        layout.centreHz = centreHz;
+    else
+        std::cout << "Ignoring centreHz=\"" << element.getStringAttribute ("centreHz") << "\" in the preset bank"
+                  << std::endl;
+    return layout;
+}
+} // namespace
+
+juce::File PresetBank::getBankFile()
+{
+    auto appDataDir = juce::File::getSpecialLocation (juce::File::userApplicationDataDirectory);
+    return appDataDir.getChildFile ("LumatoneInterpreter").getChildFile ("presets.xml");
+}
+
+void PresetBank::load (const std::vector<TuningSystem>& tunings, int defaultTuningIndex, float defaultVelocityPower)
+{
+    std::unique_ptr<juce::XmlElement> xml;
+    if (auto file = getBankFile(); file.exists()) {
+        xml = juce::XmlDocument::parse (file);
+        if (xml == nullptr || ! xml->hasTagName ("Presets")) {
+            std::cout << "Failed to parse preset bank " << file.getFullPathName() << std::endl;
+            xml.reset();
+        }
+    }
+
+    loadFromXml (xml.get(), tunings, defaultTuningIndex, defaultVelocityPower);
+}
+
+void PresetBank::loadFromXml (
+    const juce::XmlElement* bank,
+    const std::vector<TuningSystem>& tunings,
+    int defaultTuningIndex,
+    float defaultVelocityPower)
+{
+    m_presets.clear();
+    m_source.reset();
+
+    if (bank != nullptr && bank->hasTagName ("Presets")) {
+        m_source = std::make_unique<juce::XmlElement> (*bank);
+        for (auto* presetElement : bank->getChildWithTagNameIterator ("Preset")) {
+            // Tunings are referred to by name, so the bank survives new ones being added
+            int tuningIndex = defaultTuningIndex;
+            auto tuningName = presetElement->getStringAttribute ("tuning");
+            for (size_t i = 0; i < tunings.size(); ++i) {
+                if (tunings[i].name == tuningName)
+                    tuningIndex = (int) i;
+            }
+
+            addPreset (
+                presetElement->getStringAttribute ("name", "Preset " + juce::String (getNumPresets() + 1)),
+                tunings,
+                tuningIndex,
+                (float) presetElement->getDoubleAttribute ("velocityPower", defaultVelocityPower),
+                readLayout (*presetElement, {}),
+                presetElement);
+        }
+    }
+
+    if (m_presets.empty())
+        addPreset ("Default", tunings, defaultTuningIndex, defaultVelocityPower, {}, nullptr);
+}
+
+void PresetBank::addPreset (
+    const juce::String& name,
+    const std::vector<TuningSystem>& tunings,
+    int tuningIndex,
+    float velocityPower,
+    const KeyboardLayout& layout,
+    const juce::XmlElement* presetElement)
+{
+    auto& preset = m_presets.emplace_back();
+    preset.name = name;
+    preset.tuningIndex = tuningIndex;
+    preset.velocityPower = std::clamp (velocityPower, 0.1f, 10.0f);
+
+    std::array<KeyboardLayout, Preset::maxDevices> deviceLayouts;
+    deviceLayouts.fill (layout);
+    if (presetElement != nullptr) {
+        for (auto* deviceElement : presetElement->getChildWithTagNameIterator ("Device")) {
+            auto device = deviceElement->getIntAttribute ("index", -1);
+            if (device >= 0 && device < Preset::maxDevices)
+                deviceLayouts[(size_t) device] = readLayout (*deviceElement, layout);
+        }
+    }
+
+    for (size_t device = 0; device < (size_t) Preset::maxDevices; ++device) {
+        for (const auto& tuning : tunings)
+            preset.tuningTables[device].emplace_back (tuning, deviceLayouts[device]);
+    }
+
+    for (auto& devicePowers : preset.fixupPowers) {
+        for (auto& powers : devicePowers)
+            powers.fill (1.0f);
+    }
+    if (presetElement != nullptr) {
+        for (auto* fixupElement : presetElement->getChildWithTagNameIterator ("Fixup")) {
+            auto device = fixupElement->getIntAttribute ("device", 0);
+            auto channel = fixupElement->getIntAttribute ("channel");
+            auto note = fixupElement->getIntAttribute ("note");
+            auto inRange = device >= 0 && device < Preset::maxDevices && channel >= 1 && channel <= 16;
+            if (inRange && note >= 0 && note < 128)
+                preset.fixupPowers[(size_t) device][(size_t) (channel - 1)][(size_t) note] =
+                    (float) fixupElement->getDoubleAttribute ("power", 1.0);
+        }
+    }
+
+    buildVelocityCurve (preset.velocityPower, preset.velocityCurve);
+}
+
+void PresetBank::buildVelocityCurve (float power, std::array<float, 128>& curve)
+{
+    for (size_t i = 0; i < curve.size(); ++i)
+        curve[i] = std::pow ((float) i / 127.0f, power) * 127.0f;
+}
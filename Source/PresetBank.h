@@ -0,0 +1,78 @@
+#pragma once
+
+#include "TuningTable.h"
+
+#include <array>
+#include <memory>
+#include <vector>
+
+// A whole instrument configuration, compiled into the tables the audio thread reads, so that switching to it is
+// a pointer swap
+struct Preset
+{
+    // Lumatones played at once, each with its own layout and fixups
+    static constexpr int maxDevices = 4;
+
+    juce::String name;
+
+    // What the preset selects when it is switched to; the parameters can still change them afterwards
+    int tuningIndex = 0;
+    float velocityPower = 1.0f;
+
+    // Each device's layout under each of the available tunings, indexed by [device][tuning]
+    std::array<std::vector<TuningTable>, maxDevices> tuningTables;
+
+    // Velocity exponent for each key, indexed by [device][channel - 1][note], and the global curve for velocityPower
+    std::array<std::array<std::array<float, 128>, 16>, maxDevices> fixupPowers;
+    std::array<float, 128> velocityCurve;
+};
+
+// The presets behind the processor's programs, read from presets.xml next to the other settings:
+//
+//   <Presets>
+//     <Preset name="Wide 31" tuning="31 EDO" velocityPower="0.8" boardStepX="5" boardStepY="2"
+//             centreX="10" centreY="9" centreHz="261.62">
+//       <Fixup channel="2" note="10" power="1.2"/>
+//       <Device index="1" centreHz="130.81"/>
+//       <Fixup device="1" channel="3" note="4" power="0.9"/>
+//     </Preset>
+//   </Presets>
+//
+// A Device element changes the layout for that device (0 is the first Lumatone); the others get the preset's.
+// Every attribute is optional. Without a (usable) file there is a single preset with the default layout.
+class PresetBank
+{
+public:
+    static juce::File getBankFile();
+
+    // Reads and compiles every preset. Not real-time safe; the processor does it once, at construction.
+    void load (const std::vector<TuningSystem>& tunings, int defaultTuningIndex, float defaultVelocityPower);
+
+    // The same from a <Presets> element rather than the file (a journal's copy, say); nullptr gives the default
+    void loadFromXml (
+        const juce::XmlElement* bank,
+        const std::vector<TuningSystem>& tunings,
+        int defaultTuningIndex,
+        float defaultVelocityPower);
+
+    // The <Presets> element the bank was compiled from, if there was one
+    const juce::XmlElement* getSource() const { return m_source.get(); }
+
+    int getNumPresets() const { return (int) m_presets.size(); }
+    const Preset& getPreset (int index) const { return m_presets[(size_t) index]; }
+
+    // velocity / 127 raised to `power`, times 127, for every integer velocity
+    static void buildVelocityCurve (float power, std::array<float, 128>& curve);
+
+private:
+    void addPreset (
+        const juce::String& name,
+        const std::vector<TuningSystem>& tunings,
+        int tuningIndex,
+        float velocityPower,
+        const KeyboardLayout& layout,
+        const juce::XmlElement* presetElement);
+
+    std::vector<Preset> m_presets;
+    std::unique_ptr<juce::XmlElement> m_source;
+};
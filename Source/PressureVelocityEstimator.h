@@ -0,0 +1,92 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <array>
+
+// Collects the first few pressure samples of a key in CC mode and turns their rise into a note-on velocity.
+// Pressure-only keys don't send a velocity, and the first nonzero value on its own says little about how hard
+// the key was struck; the slope of the first few samples says a lot more.
+class PressureVelocityEstimator
+{
+public:
+    static constexpr int capacity = 8;
+
+    void start (int channel, int note, juce::int64 time, int pressure, juce::int64 deadline)
+    {
+        m_active = true;
+        m_channel = channel;
+        m_note = note;
+        m_deadline = deadline;
+        m_numSamples = 0;
+        addSample (time, pressure);
+    }
+
+    void clear() { m_active = false; }
+
+    // Samples past the capacity overwrite the oldest ones
+    void addSample (juce::int64 time, int pressure)
+    {
+        m_samples[(size_t) (m_numSamples % capacity)] = {time, pressure};
+        ++m_numSamples;
+    }
+
+    bool isActive() const { return m_active; }
+    bool matches (int channel, int note) const { return m_active && m_channel == channel && m_note == note; }
+
+    int getChannel() const { return m_channel; }
+    int getNote() const { return m_note; }
+    int getNumSamples() const { return m_numSamples; }
+    juce::int64 getDeadline() const { return m_deadline; }
+    juce::int64 getFirstSampleTime() const { return m_samples[(size_t) firstIndex()].time; }
+    int getLastPressure() const { return m_samples[(size_t) ((m_numSamples - 1) % capacity)].pressure; }
+
+    // Velocity is the larger of the peak pressure seen and the least-squares rise rate (in pressure units per
+    // millisecond) times velocityPerSlope. With a single sample this is just that sample's value.
+    float estimateVelocity (double samplesPerMs, float velocityPerSlope) const
+    {
+        auto count = std::min (m_numSamples, capacity);
+
+        int peak = 0;
+        double meanTime = 0.0, meanPressure = 0.0;
+        for (int i = 0; i < count; ++i) {
+            const auto& s = m_samples[(size_t) i];
+            peak = std::max (peak, s.pressure);
+            meanTime += (double) (s.time - getFirstSampleTime());
+            meanPressure += s.pressure;
+        }
+        meanTime /= count;
+        meanPressure /= count;
+
+        double covariance = 0.0, variance = 0.0;
+        for (int i = 0; i < count; ++i) {
+            const auto& s = m_samples[(size_t) i];
+            auto dt = (double) (s.time - getFirstSampleTime()) - meanTime;
+            covariance += dt * (s.pressure - meanPressure);
+            variance += dt * dt;
+        }
+
+        auto velocity = (float) peak;
+        if (variance > 0.0) {
+            auto slopePerMs = covariance / variance * samplesPerMs;
+            velocity = std::max (velocity, (float) slopePerMs * velocityPerSlope);
+        }
+        return std::clamp (velocity, 1.0f, 127.0f);
+    }
+
+private:
+    int firstIndex() const { return m_numSamples > capacity ? m_numSamples % capacity : 0; }
+
+    struct Sample
+    {
+        juce::int64 time;
+        int pressure;
+    };
+
+    bool m_active = false;
+    int m_channel = 0;
+    int m_note = 0;
+    juce::int64 m_deadline = 0;
+    int m_numSamples = 0;
+    std::array<Sample, capacity> m_samples {};
+};
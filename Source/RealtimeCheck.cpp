@@ -0,0 +1,464 @@
+#include "RealtimeCheck.h"
+
+#if LUMATONE_REALTIME_CHECKS
+
+    #include "Plugin.h"
+
+    #include <array>
+    #include <atomic>
+    #include <cstdlib>
+    #include <new>
+    #include <vector>
+
+    #include <execinfo.h>
+    #include <unistd.h>
+
+    #if JUCE_LINUX
+        #include <cerrno>
+        #include <dlfcn.h>
+        #include <pthread.h>
+        #include <time.h>
+    #endif
+
+namespace
+{
+struct Violation
+{
+    const char* what;
+    const char* scope;
+    std::array<void*, 48> frames;
+    int numFrames;
+};
+
+constexpr int maxViolations = 16;
+
+std::array<Violation, maxViolations> s_violations;
+std::atomic<int> s_numViolations {0};
+
+thread_local const char* t_scopeName = nullptr;
+thread_local bool t_inViolation = false;
+} // namespace
+
+RealtimeCheck::Scope::Scope (const char* name) : m_previousName (t_scopeName)
+{
+    t_scopeName = name;
+}
+
+RealtimeCheck::Scope::~Scope()
+{
+    t_scopeName = m_previousName;
+}
+
+void RealtimeCheck::violation (const char* what)
+{
+    if (t_scopeName == nullptr || t_inViolation)
+        return;
+
+    // backtrace() and friends may themselves end up in the interposed functions
+    t_inViolation = true;
+
+    auto index = s_numViolations.fetch_add (1);
+    if (index < maxViolations) {
+        auto& v = s_violations[(size_t) index];
+        v.what = what;
+        v.scope = t_scopeName;
+        v.numFrames = backtrace (v.frames.data(), (int) v.frames.size());
+    }
+
+    t_inViolation = false;
+}
+
+int RealtimeCheck::getNumViolations()
+{
+    return s_numViolations.load();
+}
+
+void RealtimeCheck::clearViolations()
+{
+    s_numViolations = 0;
+}
+
+void RealtimeCheck::reportViolations()
+{
+    auto numViolations = getNumViolations();
+    for (int i = 0; i < std::min (numViolations, maxViolations); ++i) {
+        const auto& v = s_violations[(size_t) i];
+        std::cerr << "Real-time violation: " << v.what << " inside " << v.scope << std::endl;
+        backtrace_symbols_fd (v.frames.data(), v.numFrames, STDERR_FILENO);
+        std::cerr << std::endl;
+    }
+    if (numViolations > maxViolations)
+        std::cerr << "... and " << (numViolations - maxViolations) << " more" << std::endl;
+}
+
+// Allocator replacement. Freeing is as much of a problem on the audio thread as allocating, so both count.
+void* operator new (std::size_t size)
+{
+    RealtimeCheck::violation ("operator new");
+    if (auto* p = std::malloc (size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size)
+{
+    return operator new (size);
+}
+
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept
+{
+    RealtimeCheck::violation ("operator new");
+    return std::malloc (size == 0 ? 1 : size);
+}
+
+void* operator new[] (std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new (size, tag);
+}
+
+void* operator new (std::size_t size, std::align_val_t alignment)
+{
+    RealtimeCheck::violation ("operator new");
+    void* p = nullptr;
+    if (posix_memalign (&p, std::max ((std::size_t) alignment, sizeof (void*)), size == 0 ? 1 : size) == 0)
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size, std::align_val_t alignment)
+{
+    return operator new (size, alignment);
+}
+
+void operator delete (void* p) noexcept
+{
+    if (p != nullptr)
+        RealtimeCheck::violation ("operator delete");
+    std::free (p);
+}
+
+void operator delete[] (void* p) noexcept
+{
+    operator delete (p);
+}
+
+void operator delete (void* p, std::size_t) noexcept
+{
+    operator delete (p);
+}
+
+void operator delete[] (void* p, std::size_t) noexcept
+{
+    operator delete (p);
+}
+
+void operator delete (void* p, std::align_val_t) noexcept
+{
+    operator delete (p);
+}
+
+void operator delete[] (void* p, std::align_val_t) noexcept
+{
+    operator delete (p);
+}
+
+void operator delete (void* p, std::size_t, std::align_val_t) noexcept
+{
+    operator delete (p);
+}
+
+void operator delete[] (void* p, std::size_t, std::align_val_t) noexcept
+{
+    operator delete (p);
+}
+
+    #if JUCE_LINUX
+// Symbol interposition: these definitions in the executable take precedence over libc's, and forward to the
+// real implementation after recording the call. open() isn't covered because fortified builds define it inline
+// in the system headers; any file I/O still gets caught at write() or fsync().
+namespace
+{
+template <typename Fn>
+Fn nextSymbol (std::atomic<Fn>& cache, const char* name)
+{
+    auto fn = cache.load (std::memory_order_acquire);
+    if (fn == nullptr) {
+        fn = reinterpret_cast<Fn> (dlsym (RTLD_NEXT, name));
+        cache.store (fn, std::memory_order_release);
+    }
+    return fn;
+}
+
+std::atomic<int (*) (pthread_mutex_t*)> s_realMutexLock {nullptr};
+std::atomic<ssize_t (*) (int, const void*, size_t)> s_realWrite {nullptr};
+std::atomic<int (*) (int)> s_realFsync {nullptr};
+std::atomic<int (*) (const timespec*, timespec*)> s_realNanosleep {nullptr};
+} // namespace
+
+extern "C" int pthread_mutex_lock (pthread_mutex_t* mutex) noexcept
+{
+    RealtimeCheck::violation ("pthread_mutex_lock");
+    return nextSymbol (s_realMutexLock, "pthread_mutex_lock") (mutex);
+}
+
+extern "C" ssize_t write (int fd, const void* buffer, size_t count)
+{
+    RealtimeCheck::violation ("write");
+    return nextSymbol (s_realWrite, "write") (fd, buffer, count);
+}
+
+extern "C" int fsync (int fd)
+{
+    RealtimeCheck::violation ("fsync");
+    return nextSymbol (s_realFsync, "fsync") (fd);
+}
+
+extern "C" int nanosleep (const timespec* duration, timespec* remaining)
+{
+    RealtimeCheck::violation ("nanosleep");
+    return nextSymbol (s_realNanosleep, "nanosleep") (duration, remaining);
+}
+
+// The C allocator, which juce::HeapBlock (so MidiBuffer growth and large MidiMessage data) calls directly. These
+// forward to glibc's own entry points rather than through dlsym, which may allocate.
+extern "C"
+{
+    void* __libc_malloc (size_t size);
+    void* __libc_calloc (size_t count, size_t size);
+    void* __libc_realloc (void* p, size_t size);
+    void __libc_free (void* p);
+    void* __libc_memalign (size_t alignment, size_t size);
+}
+
+extern "C" void* malloc (size_t size) noexcept
+{
+    RealtimeCheck::violation ("malloc");
+    return __libc_malloc (size);
+}
+
+extern "C" void* calloc (size_t count, size_t size) noexcept
+{
+    RealtimeCheck::violation ("calloc");
+    return __libc_calloc (count, size);
+}
+
+extern "C" void* realloc (void* p, size_t size) noexcept
+{
+    RealtimeCheck::violation ("realloc");
+    return __libc_realloc (p, size);
+}
+
+extern "C" void free (void* p) noexcept
+{
+    if (p != nullptr)
+        RealtimeCheck::violation ("free");
+    __libc_free (p);
+}
+
+extern "C" int posix_memalign (void** result, size_t alignment, size_t size) noexcept
+{
+    RealtimeCheck::violation ("posix_memalign");
+    if (alignment % sizeof (void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+
+    auto* p = __libc_memalign (alignment, size);
+    if (p == nullptr)
+        return ENOMEM;
+
+    *result = p;
+    return 0;
+}
+    #endif
+
+namespace
+{
+// Fixed settings and presets, as a journal replay restores them, so the outcome doesn't depend on this machine's files
+// and the run never writes to them
+void useFixedSettings (LumatoneInterpreterProcessor& processor)
+{
+    processor.setSettingsFileEnabled (false);
+
+    juce::XmlElement snapshot ("JournalSnapshot");
+    auto* settings = snapshot.createNewChildElement ("VelocityFixups");
+    settings->setAttribute ("outputMode", "channelPerVoice");
+    auto* fixup = settings->createNewChildElement ("Fixup");
+    fixup->setAttribute ("channel", 2);
+    fixup->setAttribute ("note", 10);
+    fixup->setAttribute ("power", 1.5);
+
+    auto* presets = snapshot.createNewChildElement ("Presets");
+    const auto& tunings = processor.getAvailableTunings();
+    for (int i = 0; i < 3; ++i) {
+        auto* preset = presets->createNewChildElement ("Preset");
+        preset->setAttribute ("name", "Check " + juce::String (i + 1));
+        preset->setAttribute ("tuning", tunings[(size_t) i % tunings.size()].name);
+        preset->setAttribute ("velocityPower", 0.5 + 0.5 * i);
+        auto* device = preset->createNewChildElement ("Device");
+        device->setAttribute ("index", 1 + i);
+        device->setAttribute ("centreHz", 130.81);
+    }
+
+    processor.restoreJournalSnapshot (snapshot);
+}
+} // namespace
+
+int runRealtimeCheck()
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int blockSize = 64;
+    constexpr int numBlocks = 20000;
+
+    // The journal stays on, as it always is in use, so its part of processBlock is checked too; its files go to a
+    // directory of the check's own
+    auto journalDirectory = juce::File::getSpecialLocation (juce::File::tempDirectory)
+                                .getNonexistentChildFile ("LumatoneRealtimeCheck", {}, false);
+
+    // Declared ahead of the processors, so their journal writers have finished with the files by the time it runs
+    const juce::ScopeGuard removeJournals {[&] { journalDirectory.deleteRecursively(); }};
+
+    auto processorPtr = std::make_unique<LumatoneInterpreterProcessor>();
+    auto& processor = *processorPtr;
+    processor.getInputJournal().setDirectory (journalDirectory);
+    useFixedSettings (processor);
+    processor.setRateAndBufferSizeDetails (sampleRate, blockSize);
+    processor.prepareToPlay (sampleRate, blockSize);
+
+    juce::AudioBuffer<float> audio (2, blockSize);
+    juce::MidiBuffer midi;
+    midi.ensureSize (4096);
+
+    // Load everything backtrace() needs before anything is recorded
+    {
+        std::array<void*, 4> frames;
+        backtrace (frames.data(), (int) frames.size());
+    }
+
+    // Make sure the check can fail: with a voice on every output channel, each channel 1 controller goes out 16
+    // times, so this many of them in one block are more than prepareToPlay reserves room for
+    {
+        auto overflowProcessor = std::make_unique<LumatoneInterpreterProcessor>();
+        overflowProcessor->getInputJournal().setDirectory (journalDirectory);
+        useFixedSettings (*overflowProcessor);
+        overflowProcessor->setRateAndBufferSizeDetails (sampleRate, blockSize);
+        overflowProcessor->prepareToPlay (sampleRate, blockSize);
+
+        juce::MidiBuffer flood;
+        for (int note = 0; note < 15; ++note)
+            flood.addEvent (juce::MidiMessage::noteOn (2, note, (juce::uint8) 100), 0);
+        auto numControllers = LumatoneInterpreterProcessor::maxDevices * (int) DeviceInput::capacity + 16;
+        for (int i = 0; i < numControllers; ++i)
+            flood.addEvent (juce::MidiMessage::controllerEvent (1, 1, i % 2), 1 + i * (blockSize - 1) / numControllers);
+
+        overflowProcessor->processBlock (audio, flood);
+        if (RealtimeCheck::getNumViolations() == 0) {
+            std::cerr << "Real-time check is blind: overflowing the output buffer was not detected" << std::endl;
+            return 1;
+        }
+        RealtimeCheck::clearViolations();
+    }
+
+    // Devices 1 and up come in through queues of their own, as from the Standalone app's extra Lumatones. The
+    // driver writes them in place of a MIDI thread.
+    std::array<DeviceInput, LumatoneInterpreterProcessor::maxDevices - 1> deviceInputs;
+    for (size_t i = 0; i < deviceInputs.size(); ++i)
+        processor.attachDeviceInput ((int) i + 1, &deviceInputs[i]);
+
+    // Keys currently held on one device, and whether each one is sending notes or pressure controllers
+    struct HeldKey
+    {
+        int channel;
+        int note;
+        bool ccMode;
+        int pressure;
+    };
+    struct Player
+    {
+        std::vector<HeldKey> held;
+        bool sustain = false;
+    };
+    std::array<Player, LumatoneInterpreterProcessor::maxDevices> players;
+    juce::Random random (0x1a2b3c);
+
+    // One random event, or none, from `player`
+    auto play = [&random] (Player& player, auto&& addEvent) {
+        auto& held = player.held;
+        auto roll = random.nextInt (100);
+        if (roll < 10 && held.size() < 24) {
+            // Press a key on one of the five boards, either as a note or as a pressure controller
+            HeldKey key {2 + random.nextInt (5), random.nextInt (56), random.nextBool(), 1 + random.nextInt (40)};
+            if (key.ccMode)
+                addEvent (juce::MidiMessage::controllerEvent (key.channel, key.note, key.pressure));
+            else
+                addEvent (juce::MidiMessage::noteOn (key.channel, key.note, (juce::uint8) (1 + random.nextInt (127))));
+            held.push_back (key);
+        }
+        else if (roll < 20 && ! held.empty()) {
+            auto index = (size_t) random.nextInt ((int) held.size());
+            auto key = held[index];
+            if (key.ccMode)
+                addEvent (juce::MidiMessage::controllerEvent (key.channel, key.note, 0));
+            else
+                addEvent (juce::MidiMessage::noteOff (key.channel, key.note));
+            held.erase (held.begin() + (long) index);
+        }
+        else if (roll < 80 && ! held.empty()) {
+            auto& key = held[(size_t) random.nextInt ((int) held.size())];
+            key.pressure = std::clamp (key.pressure + random.nextInt (21) - 10, 1, 127);
+            if (key.ccMode)
+                addEvent (juce::MidiMessage::controllerEvent (key.channel, key.note, key.pressure));
+            else
+                addEvent (juce::MidiMessage::aftertouchChange (key.channel, key.note, key.pressure));
+        }
+        else if (roll < 85) {
+            player.sustain = ! player.sustain;
+            addEvent (juce::MidiMessage::controllerEvent (1, 64, player.sustain ? 127 : 0));
+        }
+        else if (roll < 90) {
+            addEvent (juce::MidiMessage::pitchWheel (1, random.nextInt (16384)));
+        }
+        else if (roll < 91) {
+            // Preset switch, sometimes to a program the bank (of three) doesn't have
+            addEvent (juce::MidiMessage::programChange (1, random.nextInt (4)));
+        }
+    };
+
+    int result = 0;
+    for (int block = 0; block < numBlocks; ++block) {
+        // Between blocks, as the editor would: MTS output (bulk dumps and single note changes) and adaptive tuning
+        if (block % 500 == 250) {
+            processor.setOutputMode (
+                random.nextBool() ? LumatoneInterpreterProcessor::OutputMode::mts
+                                  : LumatoneInterpreterProcessor::OutputMode::channelPerVoice);
+            processor.setAdaptiveTuning (random.nextBool());
+        }
+
+        midi.clear();
+        for (int sample = 0; sample < blockSize; sample += 1 + random.nextInt (blockSize / 4)) {
+            play (players[0], [&] (const juce::MidiMessage& message) { midi.addEvent (message, sample); });
+            for (size_t i = 0; i < deviceInputs.size(); ++i) {
+                play (players[i + 1], [&] (const juce::MidiMessage& message) {
+                    deviceInputs[i].handleIncomingMidiMessage (nullptr, message);
+                });
+            }
+        }
+
+        processor.processBlock (audio, midi);
+
+        if (RealtimeCheck::getNumViolations() > 0) {
+            std::cerr << "Real-time check failed in block " << block << std::endl;
+            RealtimeCheck::reportViolations();
+            result = 1;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < deviceInputs.size(); ++i)
+        processor.attachDeviceInput ((int) i + 1, nullptr);
+    if (result != 0)
+        return result;
+
+    std::cout << "Real-time check passed: " << numBlocks << " blocks, no violations" << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+// Real-time safety enforcement for the audio thread. Build with -DLUMATONE_REALTIME_CHECKS=ON to enable it;
+// otherwise LUMATONE_REALTIME_SCOPE expands to nothing.
+//
+// In a checking build the global allocator is replaced, and on Linux the C allocator, mutex and blocking syscall
+// entry points are interposed too. Any call made on a thread while a LUMATONE_REALTIME_SCOPE is active is recorded
+// as a violation along with its stack. Run the Standalone app with --realtime-check to drive realistic MIDI
+// through the processor and fail on the first violation.
+#if LUMATONE_REALTIME_CHECKS
+
+class RealtimeCheck
+{
+public:
+    class Scope
+    {
+    public:
+        explicit Scope (const char* name);
+        ~Scope();
+
+    private:
+        const char* m_previousName;
+
+        JUCE_DECLARE_NON_COPYABLE (Scope)
+    };
+
+    static int getNumViolations();
+    static void clearViolations();
+
+    // Prints every recorded violation with its stack trace to stderr
+    static void reportViolations();
+
+    // Called by the interposed entry points; `what` must be a string literal
+    static void violation (const char* what);
+};
+
+    #define LUMATONE_REALTIME_SCOPE(name) RealtimeCheck::Scope JUCE_JOIN_MACRO (realtimeScope_, __LINE__) (name)
+
+// Drives generated note, pressure, controller and program change traffic from every device through a processor,
+// switching output mode and adaptive tuning now and then. Returns the process exit code.
+int runRealtimeCheck();
+
+#else
+
+    #define LUMATONE_REALTIME_SCOPE(name)
+
+#endif
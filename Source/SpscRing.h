@@ -0,0 +1,70 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <array>
+#include <atomic>
+
+// Fixed-size single-producer, single-consumer queue. Neither end blocks or allocates, so either can be the audio
+// thread: the producer finds out when the ring is full and decides what to drop, and the consumer takes everything
+// published so far. Items written together are published by one finishWrite, so the consumer never sees part of a
+// batch.
+template <typename T, juce::uint32 Capacity>
+class SpscRing
+{
+public:
+    static constexpr juce::uint32 capacity = Capacity;
+
+    // Producer
+    juce::uint32 getFreeSpace() const
+    {
+        return capacity - (m_writePos.load (std::memory_order_relaxed) - m_readPos.load (std::memory_order_acquire));
+    }
+
+    // The slot `index` places past the last published item; it reaches the consumer with finishWrite
+    T& getWriteSlot (juce::uint32 index)
+    {
+        return m_items[(m_writePos.load (std::memory_order_relaxed) + index) % capacity];
+    }
+
+    void finishWrite (juce::uint32 numItems)
+    {
+        m_writePos.store (m_writePos.load (std::memory_order_relaxed) + numItems, std::memory_order_release);
+    }
+
+    // Returns false, leaving the ring as it was, if it is full
+    bool push (const T& item)
+    {
+        if (getFreeSpace() == 0)
+            return false;
+
+        getWriteSlot (0) = item;
+        finishWrite (1);
+        return true;
+    }
+
+    // Consumer. Calls fn with every item published so far, oldest first, then frees their slots.
+    template <typename Fn>
+    void popAll (Fn&& fn)
+    {
+        auto read = m_readPos.load (std::memory_order_relaxed);
+        auto write = m_writePos.load (std::memory_order_acquire);
+        for (; read != write; ++read)
+            fn (m_items[read % capacity]);
+        m_readPos.store (read, std::memory_order_release);
+    }
+
+    // Whether the consumer has taken everything; only settled while nothing is being pushed
+    bool isEmpty() const
+    {
+        return m_readPos.load (std::memory_order_acquire) == m_writePos.load (std::memory_order_acquire);
+    }
+
+private:
+    // The positions run freely and wrap at 2^32, which only lands on the same slot if the capacity divides it
+    static_assert (Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+    std::array<T, capacity> m_items;
+    std::atomic<juce::uint32> m_writePos {0};
+    std::atomic<juce::uint32> m_readPos {0};
+};
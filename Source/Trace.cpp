@@ -0,0 +1,283 @@
+#include "Trace.h"
+
+#if LUMATONE_TRACE
+
+    #include "SpscRing.h"
+
+    #include <array>
+    #include <atomic>
+    #include <vector>
+
+    #if JUCE_LINUX
+        #include <sys/syscall.h>
+        #include <unistd.h>
+    #endif
+
+namespace
+{
+struct TraceEvent
+{
+    const char* name;
+    juce::int64 startTicks;
+    juce::int64 endTicks;
+};
+
+// The owning thread's events, drained by the writer thread. Once the owning thread has exited, the writer drains what
+// is left and frees the buffer for another thread to claim.
+struct ThreadBuffer
+{
+    enum Owner
+    {
+        unowned,
+        owned
+    };
+
+    std::atomic<int> owner {unowned};
+    std::atomic<int> ownerThread {0}; // the owning thread's system id, 0 until the claim has stored it
+    std::atomic<juce::uint32> dropped {0};
+    SpscRing<TraceEvent, 8192> events;
+
+    void push (const TraceEvent& event)
+    {
+        if (! events.push (event))
+            dropped.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    bool tryClaim (int thread)
+    {
+        auto expected = (int) unowned;
+        if (! owner.compare_exchange_strong (expected, owned))
+            return false;
+
+        ownerThread.store (thread);
+        return true;
+    }
+};
+
+// A system id for the calling thread, and whether the thread with that id has exited. Buffers are only reclaimed
+// where the system can tell; elsewhere a thread keeps its buffer for the life of the process.
+    #if JUCE_LINUX
+int getSystemThreadId()
+{
+    return (int) syscall (SYS_gettid);
+}
+
+bool hasThreadExited (int thread)
+{
+    return ! juce::File ("/proc/self/task/" + juce::String (thread)).isDirectory();
+}
+    #else
+int getSystemThreadId()
+{
+    return 1;
+}
+
+bool hasThreadExited (int)
+{
+    return false;
+}
+    #endif
+
+constexpr int maxThreads = 16;
+
+struct DrainedEvent
+{
+    TraceEvent event;
+    int threadIndex;
+};
+
+class TraceWriterThread : public juce::Thread
+{
+public:
+    TraceWriterThread() : Thread ("Trace Writer") {}
+
+    ~TraceWriterThread() override { stopThread (2000); }
+
+    // Drains until told to stop, then writes the file and reports it, on its own time
+    void run() override
+    {
+        while (! threadShouldExit()) {
+            drainAll();
+            wait (50);
+        }
+        drainAll();
+        writeJson();
+        reportFile();
+    }
+
+    void start (juce::File file)
+    {
+        m_file = std::move (file);
+        m_events.clear();
+        m_startTicks = juce::Time::getHighResolutionTicks();
+        startThread (juce::Thread::Priority::low);
+    }
+
+private:
+    void drainAll();
+    void writeJson() const;
+    void reportFile() const;
+
+    juce::File m_file;
+    juce::int64 m_startTicks = 0;
+    std::vector<DrainedEvent> m_events;
+};
+
+std::array<ThreadBuffer, maxThreads> s_buffers;
+std::atomic<bool> s_recording {false};
+
+// The calling thread's buffer. Trivially destructible, so claiming one doesn't register a thread exit handler, which
+// would allocate and lock on the audio thread.
+thread_local int t_bufferIndex = -1;
+
+// s_writer is the running recording's writer; s_finishingWriter may still be writing the previous one's file
+juce::CriticalSection s_writerLock;
+std::unique_ptr<TraceWriterThread> s_writer;
+std::unique_ptr<TraceWriterThread> s_finishingWriter;
+
+juce::CriticalSection s_lastTraceFileLock;
+juce::File s_lastTraceFile;
+
+void TraceWriterThread::drainAll()
+{
+    for (int i = 0; i < maxThreads; ++i) {
+        auto& buffer = s_buffers[(size_t) i];
+
+        // Checked before draining: a thread that had already exited pushes nothing more, so this drain takes the
+        // last of its events and the buffer can go to another thread
+        auto thread = buffer.ownerThread.load();
+        auto exited = buffer.owner.load() == ThreadBuffer::owned && thread != 0 && hasThreadExited (thread);
+
+        buffer.events.popAll ([&] (const TraceEvent& event) {
+            if (event.startTicks >= m_startTicks)
+                m_events.push_back ({event, i});
+        });
+
+        if (exited) {
+            buffer.ownerThread.store (0);
+            buffer.owner.store (ThreadBuffer::unowned);
+        }
+    }
+}
+
+void TraceWriterThread::writeJson() const
+{
+    auto ticksToMicros = [this] (juce::int64 ticks) {
+        return juce::Time::highResolutionTicksToSeconds (ticks - m_startTicks) * 1.0e6;
+    };
+
+    juce::MemoryOutputStream out;
+    out << "{\"traceEvents\":[\n";
+
+    std::array<bool, maxThreads> traced {};
+    for (const auto& drained : m_events)
+        traced[(size_t) drained.threadIndex] = true;
+
+    bool first = true;
+    for (int i = 0; i < maxThreads; ++i) {
+        if (! traced[(size_t) i])
+            continue;
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+            << ",\"args\":{\"name\":\"thread " << i << "\"}}";
+        first = false;
+    }
+
+    for (const auto& [event, threadIndex] : m_events) {
+        auto start = ticksToMicros (event.startTicks);
+        auto duration = ticksToMicros (event.endTicks) - start;
+        out << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << threadIndex << ",\"ts\":" << juce::String (start, 3) << ",\"dur\":" << juce::String (duration, 3)
+            << "}";
+        first = false;
+    }
+
+    juce::uint32 dropped = 0;
+    for (auto& buffer : s_buffers)
+        dropped += buffer.dropped.exchange (0);
+
+    out << "\n],\"otherData\":{\"droppedEvents\":" << (int) dropped << "}}\n";
+
+    if (! m_file.replaceWithData (out.getData(), out.getDataSize())) {
+        std::cout << "Failed to write trace to " << m_file.getFullPathName() << std::endl;
+    }
+}
+
+void TraceWriterThread::reportFile() const
+{
+    {
+        const juce::ScopedLock sl (s_lastTraceFileLock);
+        s_lastTraceFile = m_file;
+    }
+    std::cout << "Wrote trace to " << m_file.getFullPathName() << std::endl;
+}
+
+juce::File makeTraceFile()
+{
+    auto appDataDir = juce::File::getSpecialLocation (juce::File::userApplicationDataDirectory);
+    auto lumatoneDir = appDataDir.getChildFile ("LumatoneInterpreter");
+    if (! lumatoneDir.exists())
+        lumatoneDir.createDirectory();
+
+    return lumatoneDir.getChildFile (
+        "trace-" + juce::Time::getCurrentTime().formatted ("%Y%m%d-%H%M%S") + ".json");
+}
+} // namespace
+
+void TraceRecorder::setRecording (bool shouldRecord)
+{
+    const juce::ScopedLock sl (s_writerLock);
+
+    if (shouldRecord == s_recording.load())
+        return;
+
+    if (shouldRecord) {
+        // Only one writer may drain the buffers, so a new recording waits for the last file to be finished. That
+        // only blocks if recording is restarted while the previous trace is still being written.
+        if (s_finishingWriter != nullptr) {
+            s_finishingWriter->stopThread (5000);
+            s_finishingWriter.reset();
+        }
+
+        s_writer = std::make_unique<TraceWriterThread>();
+        s_writer->start (makeTraceFile());
+        s_recording = true;
+    }
+    else {
+        s_recording = false;
+        // The writer drains whatever is left, writes the file and reports it without holding up the caller
+        s_writer->signalThreadShouldExit();
+        s_writer->notify();
+        s_finishingWriter = std::move (s_writer);
+    }
+}
+
+bool TraceRecorder::isRecording()
+{
+    return s_recording.load (std::memory_order_relaxed);
+}
+
+juce::File TraceRecorder::getLastTraceFile()
+{
+    const juce::ScopedLock sl (s_lastTraceFileLock);
+    return s_lastTraceFile;
+}
+
+void TraceRecorder::record (const char* name, juce::int64 startTicks, juce::int64 endTicks)
+{
+    auto& index = t_bufferIndex;
+    if (index == -1) {
+        auto thread = getSystemThreadId();
+        for (int i = 0; index == -1 && i < maxThreads; ++i) {
+            if (s_buffers[(size_t) i].tryClaim (thread))
+                index = i;
+        }
+    }
+
+    // While more threads than the fixed set are recording, the rest are not traced (and try again next time)
+    if (index == -1)
+        return;
+
+    s_buffers[(size_t) index].push ({name, startTicks, endTicks});
+}
+
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+// Compile-time optional scoped tracing. Build with -DLUMATONE_TRACE=ON to enable it; otherwise
+// LUMATONE_TRACE_SCOPE expands to nothing and none of this costs anything.
+//
+// Each thread that records an event claims one of a fixed set of single-producer ring buffers, so the
+// audio thread never locks or allocates; on Linux the writer frees a thread's buffer for reuse once the
+// thread has exited. A background thread drains the buffers while recording and, once recording stops,
+// writes a Chrome trace-event JSON file (load it in chrome://tracing or ui.perfetto.dev) and prints where
+// it went.
+#if LUMATONE_TRACE
+
+class TraceRecorder
+{
+public:
+    static void setRecording (bool shouldRecord);
+    static bool isRecording();
+
+    // The file written by the most recent recording, if any. Writing finishes some time after setRecording (false).
+    static juce::File getLastTraceFile();
+
+    // Records one complete event. `name` must be a string literal (only the pointer is stored).
+    static void record (const char* name, juce::int64 startTicks, juce::int64 endTicks);
+
+    class Scope
+    {
+    public:
+        explicit Scope (const char* name) : m_name (name)
+        {
+            if (isRecording())
+                m_startTicks = juce::Time::getHighResolutionTicks();
+        }
+
+        ~Scope()
+        {
+            if (m_startTicks != 0)
+                record (m_name, m_startTicks, juce::Time::getHighResolutionTicks());
+        }
+
+    private:
+        const char* m_name;
+        juce::int64 m_startTicks = 0;
+
+        JUCE_DECLARE_NON_COPYABLE (Scope)
+    };
+};
+
+    #define LUMATONE_TRACE_SCOPE(name) TraceRecorder::Scope JUCE_JOIN_MACRO (traceScope_, __LINE__) (name)
+
+#else
+
+    #define LUMATONE_TRACE_SCOPE(name)
+
+#endif
@@ -0,0 +1,247 @@
+#include "TuningTable.h"
+
+#include <vector>
+
+namespace
+{
+// The channels and notes the generated luma.ltn actually sends (five boards of 56 keys)
+constexpr int firstBoardChannel = 2;
+constexpr int numBoards = 5;
+constexpr int keysPerBoard = 56;
+
+constexpr double samePitchTolerance = 1.0e-6;
+} // namespace
+
+std::pair<int, int> lumaNoteToLocalCoord (int note)
+{
+    switch (note) {
+    case 0:
+        return {0, 0};
+    case 1:
+        return {1, 0};
+    case 2:
+        return {0, 1};
+    case 3:
+        return {1, 1};
+    case 4:
+        return {2, 1};
+    case 5:
+        return {3, 1};
+    case 6:
+        return {4, 1};
+    case 7:
+        return {-1, 2};
+    case 8:
+        return {0, 2};
+    case 9:
+        return {1, 2};
+    case 10:
+        return {2, 2};
+    case 11:
+        return {3, 2};
+    case 12:
+        return {4, 2};
+    case 13:
+        return {-1, 3};
+    case 14:
+        return {0, 3};
+    case 15:
+        return {1, 3};
+    case 16:
+        return {2, 3};
+    case 17:
+        return {3, 3};
+    case 18:
+        return {4, 3};
+    case 19:
+        return {-2, 4};
+    case 20:
+        return {-1, 4};
+    case 21:
+        return {0, 4};
+    case 22:
+        return {1, 4};
+    case 23:
+        return {2, 4};
+    case 24:
+        return {3, 4};
+    case 25:
+        return {-2, 5};
+    case 26:
+        return {-1, 5};
+    case 27:
+        return {0, 5};
+    case 28:
+        return {1, 5};
+    case 29:
+        return {2, 5};
+    case 30:
+        return {3, 5};
+    case 31:
+        return {-3, 6};
+    case 32:
+        return {-2, 6};
+    case 33:
+        return {-1, 6};
+    case 34:
+        return {0, 6};
+    case 35:
+        return {1, 6};
+    case 36:
+        return {2, 6};
+    case 37:
+        return {-3, 7};
+    case 38:
+        return {-2, 7};
+    case 39:
+        return {-1, 7};
+    case 40:
+        return {0, 7};
+    case 41:
+        return {1, 7};
+    case 42:
+        return {2, 7};
+    case 43:
+        return {-4, 8};
+    case 44:
+        return {-3, 8};
+    case 45:
+        return {-2, 8};
+    case 46:
+        return {-1, 8};
+    case 47:
+        return {0, 8};
+    case 48:
+        return {1, 8};
+    case 49:
+        return {-3, 9};
+    case 50:
+        return {-2, 9};
+    case 51:
+        return {-1, 9};
+    case 52:
+        return {0, 9};
+    case 53:
+        return {1, 9};
+    case 54:
+        return {-1, 10};
+    case 55:
+        return {0, 10};
+    }
+    return {0, 0};
+}
+
+TuningTable::TuningTable (const TuningSystem& tuning, const KeyboardLayout& layout)
+{
+    for (int ch = 1; ch <= 16; ++ch) {
+        for (int note = 0; note < 128; ++note) {
+            auto [x, y] = lumaNoteToLocalCoord (note);
+
+            x += layout.boardStepX * (ch - 2);
+            y += layout.boardStepY * (ch - 2);
+
+            // And re-center so the middle is (10,9), or wherever the layout puts it
+            x -= layout.centreX;
+            y -= layout.centreY;
+
+            double hz = layout.centreHz * std::pow (tuning.a, x) * std::pow (tuning.b, y);
+            m_pitches[(size_t) (ch - 1)][(size_t) note] = 12.0 * std::log2 (hz / 440.0) + 69.0;
+            m_slots[(size_t) (ch - 1)][(size_t) note] = -1;
+        }
+    }
+
+    // Distinct pitches of the keys on the instrument, lowest first
+    std::vector<double> distinct;
+    for (int ch = firstBoardChannel; ch < firstBoardChannel + numBoards; ++ch) {
+        for (int note = 0; note < keysPerBoard; ++note)
+            distinct.push_back (getPitch (ch, note));
+    }
+    std::sort (distinct.begin(), distinct.end());
+    distinct.erase (
+        std::unique (
+            distinct.begin(),
+            distinct.end(),
+            [] (double p, double q) { return std::abs (p - q) < samePitchTolerance; }),
+        distinct.end());
+
+    // If there are too many, keep the middle of the range
+    auto first = distinct.size() > (size_t) numSlots ? (distinct.size() - numSlots) / 2 : 0;
+    auto count = std::min (distinct.size(), (size_t) numSlots);
+
+    for (int slot = 0; slot < numSlots; ++slot) {
+        m_slotPitches[(size_t) slot] = (size_t) slot < count ? distinct[first + (size_t) slot] : (double) slot;
+    }
+
+    for (int ch = firstBoardChannel; ch < firstBoardChannel + numBoards; ++ch) {
+        for (int note = 0; note < keysPerBoard; ++note) {
+            auto pitch = getPitch (ch, note);
+            auto found = std::lower_bound (
+                m_slotPitches.begin(), m_slotPitches.begin() + (long) count, pitch - samePitchTolerance);
+            if (found != m_slotPitches.begin() + (long) count && std::abs (*found - pitch) < samePitchTolerance)
+                m_slots[(size_t) (ch - 1)][(size_t) note] = (int) (found - m_slotPitches.begin());
+        }
+    }
+
+    // F0 7E <device> 08 01 <program> <name:16> <pitch data:128x3> <checksum> F7
+    size_t pos = 0;
+    m_bulkDump[pos++] = 0xf0;
+    m_bulkDump[pos++] = 0x7e;
+    m_bulkDump[pos++] = 0x7f; // all devices
+    m_bulkDump[pos++] = 0x08;
+    m_bulkDump[pos++] = 0x01;
+    m_bulkDump[pos++] = (juce::uint8) mtsProgram;
+
+    auto name = tuning.name.toRawUTF8();
+    for (size_t i = 0, length = strlen (name); i < 16; ++i)
+        m_bulkDump[pos++] = (juce::uint8) (i < length ? name[i] & 0x7f : ' ');
+
+    for (auto slotPitch : m_slotPitches) {
+        for (auto byte : encodePitch (slotPitch))
+            m_bulkDump[pos++] = byte;
+    }
+
+    juce::uint8 checksum = 0;
+    for (size_t i = 1; i < pos; ++i)
+        checksum ^= m_bulkDump[i];
+    m_bulkDump[pos++] = checksum & 0x7f;
+    m_bulkDump[pos++] = 0xf7;
+
+    jassert (pos == bulkDumpSize);
+}
+
+TuningTable::PitchData TuningTable::encodePitch (double midiNote)
+{
+    midiNote = std::clamp (midiNote, 0.0, 127.0);
+    auto semitone = (int) std::floor (midiNote);
+    auto fraction = (int) std::round ((midiNote - semitone) * 16384.0);
+    if (fraction >= 16384) {
+        if (semitone < 127) {
+            ++semitone;
+            fraction = 0;
+        }
+        else {
+            fraction = 16383;
+        }
+    }
+    return {(juce::uint8) semitone, (juce::uint8) (fraction >> 7), (juce::uint8) (fraction & 0x7f)};
+}
+
+std::array<juce::uint8, TuningTable::singleNoteChangeSize> TuningTable::singleNoteChange (int slot, double midiNote)
+{
+    auto data = encodePitch (midiNote);
+
+    // F0 7F <device> 08 02 <program> <count> <slot> <pitch data:3> F7
+    return {
+        0xf0,
+        0x7f,
+        0x7f,
+        0x08,
+        0x02,
+        (juce::uint8) mtsProgram,
+        0x01,
+        (juce::uint8) slot,
+        data[0],
+        data[1],
+        data[2],
+        0xf7};
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <array>
+#include <utility>
+
+// Tuning system structure
+struct TuningSystem
+{
+    juce::String name;
+    double a; // Horizontal interval
+    double b; // Vertical interval
+    juce::String description;
+
+    TuningSystem (const juce::String& n, double aVal, double bVal, const juce::String& desc = "")
+    : name (n), a (aVal), b (bVal), description (desc)
+    {}
+};
+
+// Where the boards' hex grids sit relative to each other, and which key sounds centreHz. The defaults are the
+// arrangement luma.ltn sets up: each board five columns right and two rows down from the one before.
+struct KeyboardLayout
+{
+    int boardStepX = 5;
+    int boardStepY = 2;
+    int centreX = 10;
+    int centreY = 9;
+    double centreHz = 261.62;
+};
+
+// Position of a key within its board, in the board's own hex coordinates
+std::pair<int, int> lumaNoteToLocalCoord (int note);
+
+// Everything the audio thread needs to know about a tuning, computed up front: the pitch of every key and, for
+// MIDI Tuning Standard output, which note number ("slot") each key plays plus the bulk dump that tunes the slots.
+//
+// Keys are indexed by Lumatone input channel and note. The Lumatone's 280 keys rarely have more than 128 distinct
+// pitches; when they do, the outermost ones get no fixed slot and are given one when played (see getSlot).
+class TuningTable
+{
+public:
+    static constexpr int numSlots = 128;
+    static constexpr int bulkDumpSize = 408;
+
+    // Three bytes of MTS frequency data: semitone, then a 14-bit fraction of a semitone
+    using PitchData = std::array<juce::uint8, 3>;
+
+    // Receivers play tuning program 0 unless told otherwise, and only one table is live at a time, so every table's
+    // bulk dump and single note changes go to program 0
+    static constexpr int mtsProgram = 0;
+
+    TuningTable (const TuningSystem& tuning, const KeyboardLayout& layout = {});
+
+    // Fractional MIDI note number of a key
+    double getPitch (int ch, int note) const { return m_pitches[(size_t) (ch - 1)][(size_t) note]; }
+
+    // The key's fixed slot, or -1 if it has none
+    int getSlot (int ch, int note) const { return m_slots[(size_t) (ch - 1)][(size_t) note]; }
+    double getSlotPitch (int slot) const { return m_slotPitches[(size_t) slot]; }
+
+    // Non-real-time bulk tuning dump (F0 7E ... F7) setting the pitch of every slot
+    const std::array<juce::uint8, bulkDumpSize>& getBulkDump() const { return m_bulkDump; }
+
+    static PitchData encodePitch (double midiNote);
+
+    // Real-time single note tuning change (F0 7F ... F7) retuning one slot
+    static constexpr int singleNoteChangeSize = 12;
+    static std::array<juce::uint8, singleNoteChangeSize> singleNoteChange (int slot, double midiNote);
+
+private:
+    std::array<std::array<double, 128>, 16> m_pitches;
+    std::array<std::array<int, 128>, 16> m_slots;
+    std::array<double, numSlots> m_slotPitches;
+    std::array<juce::uint8, bulkDumpSize> m_bulkDump;
+};
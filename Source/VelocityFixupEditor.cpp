@@ -1,5 +1,7 @@
 #include "VelocityFixupEditor.h"
 
+#include "Trace.h"
+
 VelocityFixupEditor::VelocityFixupEditor (LumatoneInterpreterProcessor& processor) : m_processor (processor)
 {
     // Title label
@@ -39,6 +41,8 @@ VelocityFixupEditor::VelocityFixupEditor (LumatoneInterpreterProcessor& processo
 
 void VelocityFixupEditor::paint (juce::Graphics& g)
 {
+    LUMATONE_TRACE_SCOPE ("VelocityFixupEditor::paint");
+
     g.fillAll (juce::Colour::fromRGB (40, 40, 40));
 
     g.setColour (juce::Colours::white);
@@ -66,17 +70,19 @@ void VelocityFixupEditor::resized()
 
 void VelocityFixupEditor::updateCurrentKey()
 {
+    m_currentDevice = m_processor.getMostRecentDevice();
     m_currentKey = m_processor.getMostRecentKey();
 
     // Create a descriptive string for the key
     auto [ch, note] = m_currentKey;
     auto [x, y] = m_processor.lumaNoteToLocalCoord (note);
 
-    juce::String keyInfo = juce::String::formatted ("Channel: %d, Note: %d\nCoordinate: (%d, %d)", ch, note, x, y);
+    juce::String keyInfo = juce::String::formatted (
+        "Device: %d, Channel: %d, Note: %d\nCoordinate: (%d, %d)", m_currentDevice, ch, note, x, y);
     m_keyInfoLabel.setText (keyInfo, juce::dontSendNotification);
 
     // Update slider to show current fixup value
-    float currentFixup = m_processor.getVelocityFixup (ch, note);
+    float currentFixup = m_processor.getVelocityFixup (m_currentDevice, ch, note);
     m_powerSlider.setValue (currentFixup, juce::dontSendNotification);
 }
 
@@ -84,12 +90,12 @@ void VelocityFixupEditor::onSliderValueChanged()
 {
     auto [ch, note] = m_currentKey;
     float powerValue = (float) m_powerSlider.getValue();
-    m_processor.setVelocityFixup (ch, note, powerValue);
+    m_processor.setVelocityFixup (m_currentDevice, ch, note, powerValue);
 }
 
 void VelocityFixupEditor::onResetButtonClicked()
 {
     m_powerSlider.setValue (1.0);
     auto [ch, note] = m_currentKey;
-    m_processor.setVelocityFixup (ch, note, 1.0f);
+    m_processor.setVelocityFixup (m_currentDevice, ch, note, 1.0f);
 }
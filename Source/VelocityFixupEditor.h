@@ -27,6 +27,7 @@ private:
     juce::Slider m_powerSlider;
     juce::TextButton m_resetButton;
 
+    int m_currentDevice = 0;
     std::pair<int, int> m_currentKey {0, 0};
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VelocityFixupEditor)